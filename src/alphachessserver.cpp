@@ -56,24 +56,70 @@ void AlphaChessServer::Initialize(HINSTANCE hInstance, LPSTR CmdLine, HWND hPare
   const char* ServiceName = "alphachess";
   const char* ServiceLabel = "AlphaChess Server";
 
-  if (IsRunningAsApplication())
-  {
-    bool InstallService = false;
-    bool UninstallService = false;
+  bool InstallService = false;
+  bool UninstallService = false;
 
-    /* Parse parameters */
-    if (CmdLine != NULL)
+  /* Parse parameters */
+  if (CmdLine != NULL)
+  {
+    char* str = lowerstr(CmdLine);
+    InstallService = (strpos(str, "-install") >= 0);
+    UninstallService = (strpos(str, "-uninstall") >= 0);
+    if (strpos(str, "-shards") >= 0)
     {
-      char* str = lowerstr(CmdLine);
-      InstallService = (strpos(str, "-install") >= 0);
-      UninstallService = (strpos(str, "-uninstall") >= 0);
-      delete[] str;
+      /* One single threaded reactor per processor */
+      ReactorCount = GameServerReactor::GetProcessorCount();
+      ReactorThreads = 1;
     }
+    else if (strpos(str, "-reactor") >= 0)
+    {
+      /* One reactor shared by a thread per processor */
+      ReactorCount = 1;
+      ReactorThreads = GameServerReactor::GetProcessorCount();
+    }
+    RoomActors = (strpos(str, "-actors") >= 0);
+    ValidateMoves = (strpos(str, "-validatemoves") >= 0);
+    ServerClocks = (strpos(str, "-serverclocks") >= 0);
+    int Position = strpos(str, "-port=");
+    if (Position >= 0)
+      ServerPort = atoi(str + Position + 6);
+    Position = strpos(str, "-relay=");
+    if (Position >= 0)
+      Upstream = string(str + Position + 7, strcspn(str + Position + 7, " "));
+    Position = strpos(str, "-relays=");
+    if (Position >= 0)
+      RelayPeers = string(str + Position + 8, strcspn(str + Position + 8, " "));
+    delete[] str;
+  }
 
+  if (IsRunningAsApplication())
+  {
     if (InstallService)
     {
       /* Install service */
-      bool Result = WinService::GetInstance()->Install(ServiceName, ServiceLabel, " executionmode=service");
+      string Arguments = " executionmode=service";
+      if (ReactorCount > 1)
+        Arguments += " -shards";
+      else if (ReactorCount > 0)
+        Arguments += " -reactor";
+      if (RoomActors)
+        Arguments += " -actors";
+      if (ValidateMoves)
+        Arguments += " -validatemoves";
+      if (ServerClocks)
+        Arguments += " -serverclocks";
+      if (ServerPort > 0)
+      {
+        char* Str = inttostr(ServerPort);
+        Arguments += " -port=";
+        Arguments += Str;
+        delete[] Str;
+      }
+      if (!Upstream.empty())
+        Arguments += " -relay=" + Upstream;
+      if (!RelayPeers.empty())
+        Arguments += " -relays=" + RelayPeers;
+      bool Result = WinService::GetInstance()->Install(ServiceName, ServiceLabel, Arguments.c_str());
       if (Result)
         MessageBox(NULL, "Service installed successfully!", "Install service", MB_OK);
       else
@@ -153,52 +199,71 @@ AlphaChessServer::AlphaChessServer()
   TrayMenu = NULL;
 
   ChessServer = NULL;
+  ReactorCount = 0;
+  ReactorThreads = 0;
+  RoomActors = false;
+  ValidateMoves = false;
+  ServerClocks = false;
+  ServerPort = 0;
   Service = NULL;
   WebServer = NULL;
 }
 
-string AlphaChessServer::GetJSONPlayers()
+string AlphaChessServer::GetJSONMetrics()
 {
   string Result;
   if (ChessServer != NULL)
   {
-    list<GameServerClientInfo*>* Clients = ChessServer->GetClients();
-    list<GameServerClientInfo*>::iterator it;
-    Result = "[";
-    for (it = Clients->begin(); it != Clients->end(); it++)
+    GameServerMetrics Metrics = ChessServer->GetMetrics();
+    const char* Names[] = {"clients", "rooms", "queuedMessages", "queuedBytes", "maxQueuedBytes", "queueOverflows", "droppedMessages", "coalescedMessages", "gameDataHits", "gameDataRequests", "rejectedMoves", "reclaimedSessions", "acceptedConnections", "maxAcceptBatch", "lobbySnapshots", "compressedBlobs", "compressionRatio", "compressionCost", "lockCount", "lockTime", "maxLockTime"};
+    unsigned long Values[] = {Metrics.Clients, Metrics.Rooms, Metrics.QueuedMessages, Metrics.QueuedBytes, Metrics.MaxQueuedBytes, Metrics.QueueOverflows, Metrics.DroppedMessages, Metrics.CoalescedMessages, Metrics.GameDataHits, Metrics.GameDataRequests, Metrics.RejectedMoves, Metrics.ReclaimedSessions, Metrics.AcceptedConnections, Metrics.MaxAcceptBatch, Metrics.LobbySnapshots, Metrics.CompressedBlobs, Metrics.CompressionRatio, Metrics.CompressionCost, Metrics.LockCount, Metrics.LockTime, Metrics.MaxLockTime};
+    JSONWriter Writer(Result);
+    Writer.BeginObject();
+    for (unsigned int i = 0; i < sizeof(Values)/sizeof(Values[0]); i++)
+    {
+      Writer.AddKey(Names[i]);
+      Writer.AddUnsigned(Values[i]);
+    }
+    const char* ArrayNames[] = {"sentMessages", "sendCalls"};
+    unsigned long* Arrays[] = {Metrics.SentMessages, Metrics.SendCalls};
+    for (unsigned int i = 0; i < sizeof(Arrays)/sizeof(Arrays[0]); i++)
     {
-      if (it != Clients->begin())
-        Result += ",";
-      Result += "[\"";
-      char* Str = inttostr((*it)->Id);
-      Result += Str;
-      delete[] Str;
-      Result += "\",\"";
-      Result += (*it)->Name;
-      Result += "\",\"";
-      Str = inttostr((*it)->Version);
-      Result += Str;
-      delete[] Str;
-      Result += "\",\"";
-      Str = inttostr((*it)->ConnectionTime);
-      Result += Str;
-      delete[] Str;
-      Result += "\",\"";
-      Str = inttostr((*it)->RoomId);
-      Result += Str;
-      delete[] Str;
-      Result += "\",\"";
-      Str = inttostr((*it)->Type);
-      Result += Str;
-      delete[] Str;
-      Result += "\",\"";
-      Result += ((*it)->Ready ? "1" : "0");
-      Result += "\"]";
+      Writer.AddKey(ArrayNames[i]);
+      Writer.BeginArray();
+      for (unsigned int j = 0; j < GameServerMessage::TypeCount; j++)
+        Writer.AddUnsigned(Arrays[i][j]);
+      Writer.EndArray();
     }
-    Result += "]";
-    for (it = Clients->begin(); it != Clients->end(); it++)
-      delete *it;
-    delete Clients;
+    Writer.EndObject();
+  }
+  return Result;
+}
+
+string AlphaChessServer::GetJSONPlayers()
+{
+  string Result;
+  GameServerSnapshot* Snapshot = (ChessServer != NULL ? ChessServer->AcquireSnapshot() : NULL);
+  if (Snapshot != NULL)
+  {
+    /* The admin page expects every field as a string */
+    Result.reserve(Snapshot->Clients.size() * 64);
+    JSONWriter Writer(Result);
+    Writer.BeginArray();
+    vector<GameServerClientInfo>::iterator it;
+    for (it = Snapshot->Clients.begin(); it != Snapshot->Clients.end(); it++)
+    {
+      Writer.BeginArray();
+      Writer.AddQuotedUnsigned(it->Id);
+      Writer.AddString(it->Name);
+      Writer.AddQuotedInteger(it->Version);
+      Writer.AddQuotedInteger(it->ConnectionTime);
+      Writer.AddQuotedUnsigned(it->RoomId);
+      Writer.AddQuotedInteger(it->Type);
+      Writer.AddString(it->Ready ? "1" : "0");
+      Writer.EndArray();
+    }
+    Writer.EndArray();
+    ChessServer->ReleaseSnapshot(Snapshot);
   }
   return Result;
 }
@@ -206,43 +271,63 @@ string AlphaChessServer::GetJSONPlayers()
 string AlphaChessServer::GetJSONRooms()
 {
   string Result;
-  if (ChessServer != NULL)
+  GameServerSnapshot* Snapshot = (ChessServer != NULL ? ChessServer->AcquireSnapshot() : NULL);
+  if (Snapshot != NULL)
   {
-    list<GameServerRoomInfo*>* Rooms = ChessServer->GetRooms();
-    list<GameServerRoomInfo*>::iterator it;
-    Result = "[";
-    for (it = Rooms->begin(); it != Rooms->end(); it++)
+    /* The admin page expects every field as a string */
+    Result.reserve(Snapshot->Rooms.size() * 64);
+    JSONWriter Writer(Result);
+    Writer.BeginArray();
+    vector<GameServerRoomInfo>::iterator it;
+    for (it = Snapshot->Rooms.begin(); it != Snapshot->Rooms.end(); it++)
     {
-      if (it != Rooms->begin())
-        Result += ",";
-      Result += "[\"";
-      char* Str = inttostr((*it)->Id);
-      Result += Str;
-      delete[] Str;
-      Result += "\",\"";
-      Result += (*it)->Name;
-      Result += "\",\"";
-      if ((*it)->Private)
-        Result += "Private";
+      Writer.BeginArray();
+      Writer.AddQuotedUnsigned(it->Id);
+      Writer.AddString(it->Name);
+      Writer.AddString(it->Private ? "Private" : "Public");
+      if (it->Started && it->Paused)
+        Writer.AddString("Paused");
+      else if (it->Started)
+        Writer.AddString("Playing");
       else
-        Result += "Public";
-      Result += "\",\"";
-      if ((*it)->Started && (*it)->Paused)
-        Result += "Paused";
-      else if ((*it)->Started)
-        Result += "Playing";
-      else
-        Result += "Waiting";
-      Result += "\",\"";
-      Str = inttostr((*it)->Players);
-      Result += Str;
-      delete[] Str;
-      Result += "\"]";
+        Writer.AddString("Waiting");
+      Writer.AddQuotedInteger(it->Players);
+      Writer.EndArray();
     }
-    Result += "]";
-    for (it = Rooms->begin(); it != Rooms->end(); it++)
-      delete *it;
-    delete Rooms;
+    Writer.EndArray();
+    ChessServer->ReleaseSnapshot(Snapshot);
+  }
+  return Result;
+}
+
+string AlphaChessServer::GetJSONSearch(const string& Prefix)
+{
+  string Result;
+  GameServerSnapshot* Snapshot = (ChessServer != NULL ? ChessServer->AcquireSnapshot() : NULL);
+  if (Snapshot != NULL)
+  {
+    const char* Names[] = {"rooms", "players"};
+    NameQueryType Types[] = {RoomNameQuery, PlayerNameQuery};
+    JSONWriter Writer(Result);
+    Writer.BeginObject();
+    for (unsigned int i = 0; i < sizeof(Types)/sizeof(Types[0]); i++)
+    {
+      vector<pair<unsigned int, string> > Matches;
+      GameServer::SearchSnapshot(Snapshot, Types[i], Prefix, 0, Matches);
+      Writer.AddKey(Names[i]);
+      Writer.BeginArray();
+      vector<pair<unsigned int, string> >::iterator it;
+      for (it = Matches.begin(); it != Matches.end(); it++)
+      {
+        Writer.BeginArray();
+        Writer.AddQuotedUnsigned(it->first);
+        Writer.AddString(it->second);
+        Writer.EndArray();
+      }
+      Writer.EndArray();
+    }
+    Writer.EndObject();
+    ChessServer->ReleaseSnapshot(Snapshot);
   }
   return Result;
 }
@@ -305,10 +390,29 @@ HTTPResponse* __stdcall AlphaChessServer::HTTPServerProc(HTTPRequest* Request)
       /* Load the file content */
       if (Extension == "json")
       {
-        if (GetFileName(Request->Filename) == "players")
+        if (GetFileName(Request->Filename) == "metrics")
+          Response->Content = GetInstance()->GetJSONMetrics();
+        else if (GetFileName(Request->Filename) == "players")
           Response->Content = GetInstance()->GetJSONPlayers();
         else if (GetFileName(Request->Filename) == "rooms")
           Response->Content = GetInstance()->GetJSONRooms();
+        else if (GetFileName(Request->Filename).compare(0, 7, "search-") == 0)
+        {
+          /* The prefix searched is in the file name, escaped as in URLs */
+          string Name = GetFileName(Request->Filename).substr(7);
+          string Prefix;
+          for (unsigned int i = 0; i < Name.size(); i++)
+          {
+            if (Name[i] == '%' && i + 2 < Name.size() && isxdigit((unsigned char)Name[i+1]) && isxdigit((unsigned char)Name[i+2]))
+            {
+              Prefix += (char)strtol(Name.substr(i + 1, 2).c_str(), NULL, 16);
+              i += 2;
+            }
+            else
+              Prefix += Name[i];
+          }
+          Response->Content = GetInstance()->GetJSONSearch(Prefix);
+        }
       }
       else
       {
@@ -408,10 +512,10 @@ void AlphaChessServer::Notify(const int Event, const void* Param)
 void AlphaChessServer::Start()
 {
   /* Start the server */
-  ChessServer = new GameServer();
+  ChessServer = new GameServer(ReactorCount, ReactorThreads, RoomActors, ValidateMoves, ServerClocks, Upstream, ServerPort, RelayPeers);
   ChessServer->AddObserver(this);
   WebServer = new HTTPServer(HTTPServerProc);
-  WebServer->Open(2580);
+  WebServer->Open(ServerPort > 0 ? ServerPort + 10 : 2580);
 }
 
 void AlphaChessServer::Stop()
@@ -21,6 +21,7 @@
 #define ALPHACHESSSERVER_H_
 
 #include "gameserver.h"
+#include "jsonwriter.h"
 #include "resource.h"
 #include "system.h"
 #include <cstrutils.h>
@@ -53,13 +54,23 @@ private:
   HMENU TrayMenu;
 
   GameServer* ChessServer;
+  unsigned int ReactorCount;
+  unsigned int ReactorThreads;
+  bool RoomActors;
+  bool ValidateMoves;
+  bool ServerClocks;
+  int ServerPort;
+  string Upstream;    /* Relay servers only */
+  string RelayPeers;  /* Addresses of the relay servers allowed to mirror rooms */
   WinService* Service;
   HTTPServer* WebServer;
 
   AlphaChessServer();
 
+  string GetJSONMetrics();
   string GetJSONPlayers();
   string GetJSONRooms();
+  string GetJSONSearch(const string& Prefix);
   static HTTPResponse* __stdcall HTTPServerProc(HTTPRequest* Request);
   void Notify(const int Event, const void* Param);
   void Start();
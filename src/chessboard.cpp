@@ -0,0 +1,590 @@
+/*
+* ChessBoard.cpp - Chess position used to validate the moves relayed by the server.
+*
+* Copyright (C) 2007-2011 Marc-André Lamothe.
+*
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU Library General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, write to the Free Software
+* Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+*/
+#include "chessboard.h"
+#include <ctype.h>
+#include <string.h>
+
+/* Initialise static class members */
+bool ChessBoard::Initialised = false;
+ChessBoard::Bitboard ChessBoard::KingAttacks[64];
+ChessBoard::Bitboard ChessBoard::KnightAttacks[64];
+ChessBoard::Bitboard ChessBoard::PawnAttacks[2][64];
+ChessBoard::Magic ChessBoard::BishopMagics[64];
+ChessBoard::Magic ChessBoard::RookMagics[64];
+ChessBoard::Bitboard ChessBoard::BishopTable[5248];
+ChessBoard::Bitboard ChessBoard::RookTable[102400];
+
+static const int BishopDirections[4][2] = {{1,1}, {1,-1}, {-1,1}, {-1,-1}};
+static const int RookDirections[4][2] = {{1,0}, {-1,0}, {0,1}, {0,-1}};
+
+static inline unsigned int FirstSquare(const ChessBoard::Bitboard Board)
+{
+  return __builtin_ctzll(Board);
+}
+
+static inline ChessBoard::Bitboard SquareBit(const unsigned int Square)
+{
+  return (ChessBoard::Bitboard)1 << Square;
+}
+
+// Public functions ------------------------------------------------------------
+
+ChessBoard::ChessBoard()
+{
+  Reset();
+}
+
+unsigned int ChessBoard::GenerateMoves(Move* Moves)
+{
+  /* Keep the moves that don't leave the player's king in check */
+  Move Candidates[MaxMoves];
+  unsigned int Count = PseudoLegalMoves(Candidates);
+  unsigned int Result = 0;
+  for (unsigned int i = 0; i < Count; i++)
+  {
+    Apply(Candidates[i]);
+    Color Mover = (SideToMove == White ? Black : White);
+    if (!IsAttacked(FirstSquare(Pieces[Mover][King]), SideToMove))
+      Moves[Result++] = Candidates[i];
+    Revert();
+  }
+  return Result;
+}
+
+ChessBoard::Color ChessBoard::GetSideToMove() const
+{
+  return SideToMove;
+}
+
+void ChessBoard::Initialise()
+{
+  if (Initialised)
+    return;
+
+  for (int Square = 0; Square < 64; Square++)
+  {
+    int File = Square % 8;
+    int Rank = Square / 8;
+
+    static const int KnightOffsets[8][2] = {{1,2}, {2,1}, {2,-1}, {1,-2}, {-1,-2}, {-2,-1}, {-2,1}, {-1,2}};
+    static const int KingOffsets[8][2] = {{1,0}, {1,1}, {0,1}, {-1,1}, {-1,0}, {-1,-1}, {0,-1}, {1,-1}};
+    KnightAttacks[Square] = 0;
+    KingAttacks[Square] = 0;
+    for (int i = 0; i < 8; i++)
+    {
+      int f = File + KnightOffsets[i][0], r = Rank + KnightOffsets[i][1];
+      if (f >= 0 && f < 8 && r >= 0 && r < 8)
+        KnightAttacks[Square] |= SquareBit(r*8+f);
+      f = File + KingOffsets[i][0];
+      r = Rank + KingOffsets[i][1];
+      if (f >= 0 && f < 8 && r >= 0 && r < 8)
+        KingAttacks[Square] |= SquareBit(r*8+f);
+    }
+
+    PawnAttacks[White][Square] = 0;
+    PawnAttacks[Black][Square] = 0;
+    for (int df = -1; df <= 1; df += 2)
+      if (File+df >= 0 && File+df < 8)
+      {
+        if (Rank < 7)
+          PawnAttacks[White][Square] |= SquareBit((Rank+1)*8+File+df);
+        if (Rank > 0)
+          PawnAttacks[Black][Square] |= SquareBit((Rank-1)*8+File+df);
+      }
+  }
+
+  InitialiseMagics(BishopMagics, BishopTable, BishopDirections);
+  InitialiseMagics(RookMagics, RookTable, RookDirections);
+  Initialised = true;
+}
+
+bool ChessBoard::IsCheck() const
+{
+  return IsAttacked(FirstSquare(Pieces[SideToMove][King]), (SideToMove == White ? Black : White));
+}
+
+bool ChessBoard::IsGameOver()
+{
+  /* Checkmate or stalemate */
+  Move Moves[MaxMoves];
+  return (GenerateMoves(Moves) == 0);
+}
+
+bool ChessBoard::MakeMove(const unsigned int From, const unsigned int To, const PieceType Promotion)
+{
+  if (From > 63 || To > 63)
+    return false;
+
+  Move Moves[MaxMoves];
+  unsigned int Count = GenerateMoves(Moves);
+  for (unsigned int i = 0; i < Count; i++)
+    if (Moves[i].From == From && Moves[i].To == To && (Moves[i].Promotion == NoPiece || Moves[i].Promotion == Promotion))
+    {
+      Apply(Moves[i]);
+      return true;
+    }
+  return false;
+}
+
+unsigned long long ChessBoard::Perft(const unsigned int Depth)
+{
+  if (Depth == 0)
+    return 1;
+
+  /* Count the leaf positions, to check the move generator against known results */
+  Move Moves[MaxMoves];
+  unsigned int Count = PseudoLegalMoves(Moves);
+  unsigned long long Result = 0;
+  for (unsigned int i = 0; i < Count; i++)
+  {
+    Apply(Moves[i]);
+    Color Mover = (SideToMove == White ? Black : White);
+    if (!IsAttacked(FirstSquare(Pieces[Mover][King]), SideToMove))
+      Result += Perft(Depth-1);
+    Revert();
+  }
+  return Result;
+}
+
+bool ChessBoard::Promote(const PieceType Promotion)
+{
+  /* Change the piece the last move promoted a pawn to */
+  if (History.empty() || History.back().Played.Promotion == NoPiece || Promotion < Knight || Promotion > Queen)
+    return false;
+  UndoInfo& Last = History.back();
+  Color Mover = (SideToMove == White ? Black : White);
+  RemovePiece(Last.Played.To, Mover, (PieceType)Squares[Last.Played.To]);
+  PlacePiece(Last.Played.To, Mover, Promotion);
+  Last.Played.Promotion = Promotion;
+  return true;
+}
+
+void ChessBoard::Reset()
+{
+  Clear();
+
+  /* Starting position */
+  static const PieceType BackRank[8] = {Rook, Knight, Bishop, Queen, King, Bishop, Knight, Rook};
+  for (unsigned int File = 0; File < 8; File++)
+  {
+    PlacePiece(File, White, BackRank[File]);
+    PlacePiece(8+File, White, Pawn);
+    PlacePiece(48+File, Black, Pawn);
+    PlacePiece(56+File, Black, BackRank[File]);
+  }
+  SideToMove = White;
+  Castling = WhiteKingSide | WhiteQueenSide | BlackKingSide | BlackQueenSide;
+  EnPassant = -1;
+}
+
+bool ChessBoard::SetPosition(const char* Fen)
+{
+  /* The pieces from a8 to h1, the side to move, the castling rights and the
+     en passant square of a FEN record, the move counters are ignored */
+  static const char Letters[] = "pnbrqk";
+  Clear();
+  const char* Position = Fen;
+  int Rank = 7;
+  int File = 0;
+  bool Valid = true;
+  for (; Valid && *Position != ' ' && *Position != 0; Position++)
+  {
+    const char* Letter = strchr(Letters, tolower(*Position));
+    if (*Position == '/')
+    {
+      Valid = (File == 8 && Rank > 0);
+      Rank--;
+      File = 0;
+    }
+    else if (*Position >= '1' && *Position <= '8')
+      File += *Position - '0';
+    else if (Letter != NULL && File < 8)
+      PlacePiece(Rank*8 + File++, (isupper(*Position) ? White : Black), (PieceType)(Letter - Letters));
+    else
+      Valid = false;
+    Valid = Valid && (File <= 8);
+  }
+  Valid = Valid && (Rank == 0 && File == 8 && *Position++ == ' ');
+
+  /* Side to move */
+  if (Valid && (*Position == 'w' || *Position == 'b'))
+    SideToMove = (*Position++ == 'w' ? White : Black);
+  else
+    Valid = false;
+  Valid = Valid && (*Position++ == ' ');
+
+  /* Castling rights */
+  Castling = 0;
+  if (Valid && *Position == '-')
+    Position++;
+  else
+  {
+    for (; Valid && *Position != ' ' && *Position != 0; Position++)
+    {
+      if (*Position == 'K')
+        Castling |= WhiteKingSide;
+      else if (*Position == 'Q')
+        Castling |= WhiteQueenSide;
+      else if (*Position == 'k')
+        Castling |= BlackKingSide;
+      else if (*Position == 'q')
+        Castling |= BlackQueenSide;
+      else
+        Valid = false;
+    }
+  }
+  Valid = Valid && (*Position++ == ' ');
+
+  /* En passant square */
+  EnPassant = -1;
+  if (Valid && *Position >= 'a' && *Position <= 'h' && (Position[1] == '3' || Position[1] == '6'))
+    EnPassant = (Position[1] - '1')*8 + (Position[0] - 'a');
+  else if (!Valid || *Position != '-')
+    Valid = false;
+
+  /* Each side has a single king */
+  for (int Side = White; Valid && Side <= Black; Side++)
+    Valid = (Pieces[Side][King] != 0 && (Pieces[Side][King] & (Pieces[Side][King] - 1)) == 0);
+  if (!Valid)
+    Reset();
+  return Valid;
+}
+
+bool ChessBoard::Undo()
+{
+  if (History.empty())
+    return false;
+  Revert();
+  return true;
+}
+
+// Private functions -----------------------------------------------------------
+
+void ChessBoard::Apply(const Move& Played)
+{
+  Color Us = SideToMove;
+  Color Them = (Us == White ? Black : White);
+
+  UndoInfo Info;
+  Info.Played = Played;
+  Info.Moved = Squares[Played.From];
+  Info.Captured = Squares[Played.To];
+  Info.Castling = Castling;
+  Info.EnPassant = EnPassant;
+  History.push_back(Info);
+
+  /* Captures, en passant captures the pawn behind the target square */
+  if (Info.Moved == Pawn && (int)Played.To == EnPassant)
+    RemovePiece(Us == White ? Played.To-8 : Played.To+8, Them, Pawn);
+  else if (Info.Captured != NoPiece)
+    RemovePiece(Played.To, Them, (PieceType)Info.Captured);
+
+  RemovePiece(Played.From, Us, (PieceType)Info.Moved);
+  PlacePiece(Played.To, Us, (Played.Promotion != NoPiece ? (PieceType)Played.Promotion : (PieceType)Info.Moved));
+
+  /* Castling also moves the rook */
+  if (Info.Moved == King && (Played.To == Played.From+2 || Played.From == Played.To+2))
+  {
+    unsigned int RookFrom = (Played.To > Played.From ? Played.From+3 : Played.From-4);
+    unsigned int RookTo = (Played.To > Played.From ? Played.From+1 : Played.From-1);
+    RemovePiece(RookFrom, Us, Rook);
+    PlacePiece(RookTo, Us, Rook);
+  }
+
+  EnPassant = (Info.Moved == Pawn && (Played.To == Played.From+16 || Played.From == Played.To+16) ? (Played.From+Played.To)/2 : -1);
+
+  /* Moving the king or a rook, or capturing a rook, loses the castling rights */
+  for (unsigned int i = 0; i < 2; i++)
+  {
+    unsigned int Square = (i == 0 ? Played.From : Played.To);
+    if (Square == 0)
+      Castling &= ~WhiteQueenSide;
+    else if (Square == 7)
+      Castling &= ~WhiteKingSide;
+    else if (Square == 4)
+      Castling &= ~(WhiteKingSide | WhiteQueenSide);
+    else if (Square == 56)
+      Castling &= ~BlackQueenSide;
+    else if (Square == 63)
+      Castling &= ~BlackKingSide;
+    else if (Square == 60)
+      Castling &= ~(BlackKingSide | BlackQueenSide);
+  }
+
+  SideToMove = Them;
+}
+
+ChessBoard::Bitboard ChessBoard::BishopAttacks(const unsigned int Square, const Bitboard Occupancy)
+{
+  const Magic& Entry = BishopMagics[Square];
+  return Entry.Attacks[((Occupancy & Entry.Mask) * Entry.Number) >> Entry.Shift];
+}
+
+void ChessBoard::Clear()
+{
+  for (int i = 0; i < 6; i++)
+  {
+    Pieces[White][i] = 0;
+    Pieces[Black][i] = 0;
+  }
+  Occupied[White] = 0;
+  Occupied[Black] = 0;
+  for (int i = 0; i < 64; i++)
+    Squares[i] = NoPiece;
+  History.clear();
+}
+
+bool ChessBoard::IsAttacked(const unsigned int Square, const Color By) const
+{
+  Bitboard All = Occupied[White] | Occupied[Black];
+  return ((PawnAttacks[By == White ? Black : White][Square] & Pieces[By][Pawn]) != 0 ||
+          (KnightAttacks[Square] & Pieces[By][Knight]) != 0 ||
+          (KingAttacks[Square] & Pieces[By][King]) != 0 ||
+          (BishopAttacks(Square, All) & (Pieces[By][Bishop] | Pieces[By][Queen])) != 0 ||
+          (RookAttacks(Square, All) & (Pieces[By][Rook] | Pieces[By][Queen])) != 0);
+}
+
+void ChessBoard::InitialiseMagics(Magic* Magics, Bitboard* Table, const int Directions[4][2])
+{
+  static Bitboard Occupancies[4096];
+  static Bitboard References[4096];
+  static unsigned int Epochs[4096];
+  unsigned int Epoch = 0;
+  Bitboard Seed = 0x9E3779B97F4A7C15ULL;
+
+  for (int Square = 0; Square < 64; Square++)
+  {
+    /* The squares that can block the piece, the edges never matter */
+    Magic& Entry = Magics[Square];
+    Entry.Mask = 0;
+    for (int i = 0; i < 4; i++)
+    {
+      int f = Square % 8 + Directions[i][0], r = Square / 8 + Directions[i][1];
+      while (f+Directions[i][0] >= 0 && f+Directions[i][0] < 8 && r+Directions[i][1] >= 0 && r+Directions[i][1] < 8)
+      {
+        Entry.Mask |= SquareBit(r*8+f);
+        f += Directions[i][0];
+        r += Directions[i][1];
+      }
+    }
+    unsigned int Bits = __builtin_popcountll(Entry.Mask);
+    Entry.Shift = 64 - Bits;
+    Entry.Attacks = Table;
+    Table += (1 << Bits);
+
+    /* Attacks for every subset of the blockers */
+    unsigned int Count = 0;
+    Bitboard Subset = 0;
+    do
+    {
+      Occupancies[Count] = Subset;
+      References[Count] = SlidingAttacks(Square, Subset, Directions);
+      Count++;
+      Subset = (Subset - Entry.Mask) & Entry.Mask;
+    } while (Subset != 0);
+
+    /* Try sparse random numbers until one maps every subset without collision */
+    bool Found = false;
+    while (!Found)
+    {
+      Bitboard Candidate = ~(Bitboard)0;
+      for (int i = 0; i < 3; i++)
+      {
+        Seed ^= Seed >> 12;
+        Seed ^= Seed << 25;
+        Seed ^= Seed >> 27;
+        Candidate &= Seed * 2685821657736338717ULL;
+      }
+      if (__builtin_popcountll((Entry.Mask * Candidate) & 0xFF00000000000000ULL) < 6)
+        continue;
+
+      Epoch++;
+      Found = true;
+      for (unsigned int i = 0; i < Count && Found; i++)
+      {
+        unsigned int Index = (unsigned int)(((Occupancies[i] & Entry.Mask) * Candidate) >> Entry.Shift);
+        if (Epochs[Index] != Epoch)
+        {
+          Epochs[Index] = Epoch;
+          Entry.Attacks[Index] = References[i];
+        }
+        else if (Entry.Attacks[Index] != References[i])
+          Found = false;
+      }
+      Entry.Number = Candidate;
+    }
+  }
+}
+
+void ChessBoard::PlacePiece(const unsigned int Square, const Color Side, const PieceType Type)
+{
+  Pieces[Side][Type] |= SquareBit(Square);
+  Occupied[Side] |= SquareBit(Square);
+  Squares[Square] = Type;
+}
+
+unsigned int ChessBoard::PseudoLegalMoves(Move* Moves) const
+{
+  Color Us = SideToMove;
+  Color Them = (Us == White ? Black : White);
+  Bitboard All = Occupied[White] | Occupied[Black];
+  Bitboard Targets = ~Occupied[Us];
+  unsigned int Count = 0;
+
+  /* Pawns */
+  Bitboard Captures = Occupied[Them] | (EnPassant >= 0 ? SquareBit(EnPassant) : 0);
+  for (Bitboard Board = Pieces[Us][Pawn]; Board != 0; Board &= Board-1)
+  {
+    unsigned int From = FirstSquare(Board);
+    Bitboard Destinations = PawnAttacks[Us][From] & Captures;
+    unsigned int Forward = (Us == White ? From+8 : From-8);
+    if ((All & SquareBit(Forward)) == 0)
+    {
+      Destinations |= SquareBit(Forward);
+      unsigned int Double = (Us == White ? From+16 : From-16);
+      if ((Us == White ? From/8 == 1 : From/8 == 6) && (All & SquareBit(Double)) == 0)
+        Destinations |= SquareBit(Double);
+    }
+    for (; Destinations != 0; Destinations &= Destinations-1)
+    {
+      unsigned int To = FirstSquare(Destinations);
+      Moves[Count].From = From;
+      Moves[Count].To = To;
+      if (To/8 == 0 || To/8 == 7)
+      {
+        static const PieceType Promotions[4] = {Queen, Rook, Bishop, Knight};
+        for (int i = 0; i < 4; i++)
+        {
+          Moves[Count].From = From;
+          Moves[Count].To = To;
+          Moves[Count++].Promotion = Promotions[i];
+        }
+      }
+      else
+        Moves[Count++].Promotion = NoPiece;
+    }
+  }
+
+  /* Pieces */
+  for (int Type = Knight; Type <= King; Type++)
+    for (Bitboard Board = Pieces[Us][Type]; Board != 0; Board &= Board-1)
+    {
+      unsigned int From = FirstSquare(Board);
+      Bitboard Destinations;
+      if (Type == Knight)
+        Destinations = KnightAttacks[From];
+      else if (Type == Bishop)
+        Destinations = BishopAttacks(From, All);
+      else if (Type == Rook)
+        Destinations = RookAttacks(From, All);
+      else if (Type == Queen)
+        Destinations = BishopAttacks(From, All) | RookAttacks(From, All);
+      else
+        Destinations = KingAttacks[From];
+      for (Destinations &= Targets; Destinations != 0; Destinations &= Destinations-1)
+      {
+        Moves[Count].From = From;
+        Moves[Count].To = FirstSquare(Destinations);
+        Moves[Count++].Promotion = NoPiece;
+      }
+    }
+
+  /* Castling, the king can't castle out of or through check */
+  unsigned int KingSquare = (Us == White ? 4 : 60);
+  unsigned int KingSide = (Us == White ? WhiteKingSide : BlackKingSide);
+  unsigned int QueenSide = (Us == White ? WhiteQueenSide : BlackQueenSide);
+  if ((Castling & (KingSide | QueenSide)) != 0 && (Pieces[Us][King] & SquareBit(KingSquare)) != 0 && !IsAttacked(KingSquare, Them))
+  {
+    if ((Castling & KingSide) != 0 && (All & (SquareBit(KingSquare+1) | SquareBit(KingSquare+2))) == 0 && !IsAttacked(KingSquare+1, Them))
+    {
+      Moves[Count].From = KingSquare;
+      Moves[Count].To = KingSquare+2;
+      Moves[Count++].Promotion = NoPiece;
+    }
+    if ((Castling & QueenSide) != 0 && (All & (SquareBit(KingSquare-1) | SquareBit(KingSquare-2) | SquareBit(KingSquare-3))) == 0 && !IsAttacked(KingSquare-1, Them))
+    {
+      Moves[Count].From = KingSquare;
+      Moves[Count].To = KingSquare-2;
+      Moves[Count++].Promotion = NoPiece;
+    }
+  }
+  return Count;
+}
+
+void ChessBoard::RemovePiece(const unsigned int Square, const Color Side, const PieceType Type)
+{
+  Pieces[Side][Type] &= ~SquareBit(Square);
+  Occupied[Side] &= ~SquareBit(Square);
+  Squares[Square] = NoPiece;
+}
+
+void ChessBoard::Revert()
+{
+  UndoInfo Info = History.back();
+  History.pop_back();
+  const Move& Played = Info.Played;
+  Color Them = SideToMove;
+  Color Us = (Them == White ? Black : White);
+
+  RemovePiece(Played.To, Us, (PieceType)Squares[Played.To]);
+  PlacePiece(Played.From, Us, (PieceType)Info.Moved);
+
+  if (Info.Moved == King && (Played.To == Played.From+2 || Played.From == Played.To+2))
+  {
+    unsigned int RookFrom = (Played.To > Played.From ? Played.From+3 : Played.From-4);
+    unsigned int RookTo = (Played.To > Played.From ? Played.From+1 : Played.From-1);
+    RemovePiece(RookTo, Us, Rook);
+    PlacePiece(RookFrom, Us, Rook);
+  }
+
+  if (Info.Moved == Pawn && (int)Played.To == Info.EnPassant)
+    PlacePiece(Us == White ? Played.To-8 : Played.To+8, Them, Pawn);
+  else if (Info.Captured != NoPiece)
+    PlacePiece(Played.To, Them, (PieceType)Info.Captured);
+
+  Castling = Info.Castling;
+  EnPassant = Info.EnPassant;
+  SideToMove = Us;
+}
+
+ChessBoard::Bitboard ChessBoard::RookAttacks(const unsigned int Square, const Bitboard Occupancy)
+{
+  const Magic& Entry = RookMagics[Square];
+  return Entry.Attacks[((Occupancy & Entry.Mask) * Entry.Number) >> Entry.Shift];
+}
+
+ChessBoard::Bitboard ChessBoard::SlidingAttacks(const unsigned int Square, const Bitboard Occupancy, const int Directions[4][2])
+{
+  /* Walk each direction up to the first blocker, used to build the tables */
+  Bitboard Result = 0;
+  for (int i = 0; i < 4; i++)
+  {
+    int f = Square % 8 + Directions[i][0], r = Square / 8 + Directions[i][1];
+    while (f >= 0 && f < 8 && r >= 0 && r < 8)
+    {
+      Result |= SquareBit(r*8+f);
+      if ((Occupancy & SquareBit(r*8+f)) != 0)
+        break;
+      f += Directions[i][0];
+      r += Directions[i][1];
+    }
+  }
+  return Result;
+}
@@ -0,0 +1,111 @@
+/*
+* ChessBoard.h - Chess position used to validate the moves relayed by the server.
+*
+* Copyright (C) 2007-2011 Marc-André Lamothe.
+*
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU Library General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, write to the Free Software
+* Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+*/
+#ifndef CHESSBOARD_H_
+#define CHESSBOARD_H_
+
+#include <vector>
+
+using namespace std;
+
+/* Position stored as one 64 bits board per piece and color, square 0 is a1,
+ * 7 is h1 and 63 is h8. Sliding pieces use magic bitboards, the tables are
+ * built once by Initialise() before any board is used. */
+class ChessBoard
+{
+public:
+  typedef unsigned long long Bitboard;
+
+  enum Color {White, Black};
+  enum PieceType {Pawn, Knight, Bishop, Rook, Queen, King, NoPiece};
+
+  struct Move
+  {
+    unsigned char From;
+    unsigned char To;
+    unsigned char Promotion;
+  };
+
+  static const unsigned int MaxMoves = 256;
+
+  ChessBoard();
+
+  unsigned int GenerateMoves(Move* Moves);
+  Color GetSideToMove() const;
+  static void Initialise();
+  bool IsCheck() const;
+  bool IsGameOver();
+  bool MakeMove(const unsigned int From, const unsigned int To, const PieceType Promotion = Queen);
+  unsigned long long Perft(const unsigned int Depth);
+  bool Promote(const PieceType Promotion);
+  void Reset();
+  bool SetPosition(const char* Fen);
+  bool Undo();
+
+private:
+  struct Magic
+  {
+    Bitboard Mask;
+    Bitboard Number;
+    Bitboard* Attacks;
+    unsigned int Shift;
+  };
+
+  struct UndoInfo
+  {
+    Move Played;
+    unsigned char Moved;
+    unsigned char Captured;
+    unsigned char Castling;
+    signed char EnPassant;
+  };
+
+  enum CastlingRight {WhiteKingSide = 1, WhiteQueenSide = 2, BlackKingSide = 4, BlackQueenSide = 8};
+
+  static bool Initialised;
+  static Bitboard KingAttacks[64];
+  static Bitboard KnightAttacks[64];
+  static Bitboard PawnAttacks[2][64];
+  static Magic BishopMagics[64];
+  static Magic RookMagics[64];
+  static Bitboard BishopTable[5248];
+  static Bitboard RookTable[102400];
+
+  Bitboard Pieces[2][6];
+  Bitboard Occupied[2];
+  unsigned char Squares[64];  /* Piece type on each square */
+  Color SideToMove;
+  unsigned int Castling;
+  int EnPassant;              /* Square behind a pawn that moved two squares, -1 if none */
+  vector<UndoInfo> History;
+
+  void Apply(const Move& Played);
+  static Bitboard BishopAttacks(const unsigned int Square, const Bitboard Occupancy);
+  void Clear();
+  bool IsAttacked(const unsigned int Square, const Color By) const;
+  static void InitialiseMagics(Magic* Magics, Bitboard* Table, const int Directions[4][2]);
+  void PlacePiece(const unsigned int Square, const Color Side, const PieceType Type);
+  unsigned int PseudoLegalMoves(Move* Moves) const;
+  void RemovePiece(const unsigned int Square, const Color Side, const PieceType Type);
+  void Revert();
+  static Bitboard RookAttacks(const unsigned int Square, const Bitboard Occupancy);
+  static Bitboard SlidingAttacks(const unsigned int Square, const Bitboard Occupancy, const int Directions[4][2]);
+};
+
+#endif
@@ -31,45 +31,162 @@ struct ConnectionInfo
 /* Initialise static class members */
 const int GameServer::Port = 2570;
 const char* GameServer::Id = "AlphaChess";
+const int GameServer::CompactVersion = 500;
+const int GameServer::CompressionVersion = 510;
 const int GameServer::SupportedVersion = 402;
-const int GameServer::Version = 405;
+const int GameServer::Version = 510;
 
 // Public functions ------------------------------------------------------------
 
-GameServer::GameServer()
+GameServer::GameServer(unsigned int ReactorCount, unsigned int ReactorThreads, bool Actors, bool Validate, bool Clocks, const string& UpstreamAddress, int ServerPort, const string& RelayAddresses)
+  : Clients(!UpstreamAddress.empty())
 {
-  ClientIdCounter = 0;
-  RoomIdCounter = 0;
+  InitializeCriticalSection(&LobbyLock);
+  InitializeCriticalSection(&FeedLock);
+  InitializeCriticalSection(&IndexLock);
+  LobbyRevision = 0;
+  SnapshotRevision = 0;
+  LobbySnapshots = 0;
+  GameDataHits = 0;
+  GameDataRequests = 0;
+  RejectedMoves = 0;
+  ReclaimedSessions = 0;
+  AcceptedConnections = 0;
+  MaxAcceptBatch = 0;
+  CompressedBlobs = 0;
+  CompressionInput = 0;
+  CompressionOutput = 0;
+  CompressionTime = 0;
 
-  Mutex = CreateMutex(NULL,FALSE,NULL);
+  /* The attack tables are built once, before any room is created */
+  ValidateMoves = Validate;
+  if (ValidateMoves)
+    ChessBoard::Initialise();
+
+  ServerClocks = Clocks;
+  Upstream = UpstreamAddress;
+  string::size_type Start = 0;
+  while (Start < RelayAddresses.size())
+  {
+    /* The relay servers' addresses are separated by commas */
+    string::size_type End = RelayAddresses.find(',', Start);
+    if (End == string::npos)
+      End = RelayAddresses.size();
+    unsigned long Address = inet_addr(RelayAddresses.substr(Start, End - Start).c_str());
+    if (Address != INADDR_NONE)
+      RelayPeers.push_back(Address);
+    Start = End + 1;
+  }
+  ListenPort = (ServerPort > 0 ? ServerPort : Port);
+  InitializeCriticalSection(&TimerLock);
+  Timers = new TimingWheel(0);
+  TimerTimestamp = GetTickCount();
+  TimerThread = new GameServerTimerThread(this);
+  InitializeCriticalSection(&SnapshotLock);
+  Snapshot = NULL;
+  SnapshotRequested = false;
+  SnapshotWanted = CreateEvent(NULL, FALSE, FALSE, NULL);
+  SnapshotPublished = CreateEvent(NULL, TRUE, FALSE, NULL);
+  SnapshotThread = new GameServerSnapshotThread(this);
+  LockCount = 0;
+  LockDepth = 0;
+  LockTime = 0;
+  MaxLockTime = 0;
+  QueryPerformanceFrequency(&TimerFrequency);
+
+  /* Without a reactor each client has its own thread, with several reactors
+     each one is a shard pinned to its own processor */
+  NextReactor = 0;
+  for (unsigned int i = 0; i < ReactorCount; i++)
+    Reactors.push_back(new GameServerReactor(ReactorThreads, (ReactorCount > 1 ? (int)i : -1)));
+
+  /* Data is always sent through a reactor so that no lock is held while sending */
+  Writer = (ReactorCount == 0 ? new GameServerReactor(1) : NULL);
+
+  /* Rooms run on their shard, players with their own thread need a scheduler */
+  RoomActors = Actors;
+  Scheduler = (RoomActors && ReactorCount == 0 ? new GameServerReactor(GameServerReactor::GetProcessorCount()) : NULL);
 
   Resume();
 }
 
 GameServer::~GameServer()
 {
-  if (WaitForSingleObject(Mutex,INFINITE) == WAIT_OBJECT_0)
-  {
-    list<GameServerClient*>::iterator it;
-    for (it = Clients.begin(); it != Clients.end(); it++)
-      delete *it;
-    Clients.clear();
+  delete TimerThread;
+  delete SnapshotThread;
+  if (Snapshot != NULL)
+    delete Snapshot;
+  CloseHandle(SnapshotWanted);
+  CloseHandle(SnapshotPublished);
+  DeleteCriticalSection(&SnapshotLock);
 
-    list<GameServerRoom*>::iterator it2;
-    for (it2 = Rooms.begin(); it2 != Rooms.end(); it2++)
+  vector<GameServerReactor*>::iterator it0;
+  for (it0 = Reactors.begin(); it0 != Reactors.end(); it0++)
+    delete *it0;
+  Reactors.clear();
+  if (Writer != NULL)
+    delete Writer;
+  if (Scheduler != NULL)
+    delete Scheduler;
+
+  if (Lock())
+  {
+    for (unsigned int i = 0; i < Clients.Size(); i++)
+      delete Clients[i];
+    Clients.Clear();
+    vector<GameServerClient*>::iterator it2;
+    for (it2 = RetiredClients.begin(); it2 != RetiredClients.end(); it2++)
       delete *it2;
-    Rooms.clear();
+    RetiredClients.clear();
+
+    for (unsigned int i = 0; i < Rooms.Size(); i++)
+      DeleteRoom(Rooms[i]);
+    Rooms.Clear();
+    vector<GameServerRoom*>::iterator it1;
+    for (it1 = ClosedMirrors.begin(); it1 != ClosedMirrors.end(); it1++)
+      DeleteRoom(*it1);
+    ClosedMirrors.clear();
+
+    Unlock();
+    DeleteCriticalSection(&LobbyLock);
+  }
+  DeleteCriticalSection(&FeedLock);
+  DeleteCriticalSection(&IndexLock);
+  delete Timers;
+  DeleteCriticalSection(&TimerLock);
+}
 
-    ReleaseMutex(Mutex);
-    CloseHandle(Mutex);
+GameServerSnapshot* GameServer::AcquireSnapshot()
+{
+  /* Ask the snapshot thread for a newer snapshot and go on with the current
+     one, only waiting a period at most when there is none yet */
+  EnterCriticalSection(&SnapshotLock);
+  bool Missing = (Snapshot == NULL);
+  if ((Missing || GetTickCount() - Snapshot->Timestamp >= SnapshotPeriod) && !SnapshotRequested)
+  {
+    SnapshotRequested = true;
+    ResetEvent(SnapshotPublished);
+    SetEvent(SnapshotWanted);
   }
+  LeaveCriticalSection(&SnapshotLock);
+  if (Missing)
+    WaitForSingleObject(SnapshotPublished, SnapshotPeriod);
+
+  EnterCriticalSection(&SnapshotLock);
+  GameServerSnapshot* Current = Snapshot;
+  if (Current != NULL)
+    Current->References++;
+  LeaveCriticalSection(&SnapshotLock);
+  return Current;
 }
 
 void GameServer::ChangeSeat(GameServerClient* Client, PlayerType Type)
 {
-  if (Client != NULL && WaitForSingleObject(Mutex,INFINITE) == WAIT_OBJECT_0)
+  /* Seats only change within a room, the lobby is left alone. A relay's
+     rooms are played on the upstream server. */
+  if (Client != NULL && !Client->Relaying && Upstream.empty() && !Post(Client->Room, ChangeSeatCommand, Client, Type))
   {
-    GameServerRoom* Room = Client->Room;
+    GameServerRoom* Room = LockRoom(Client);
     if (Room != NULL)
     {
       if ((Type == ObserverType && (Client == Room->BlackPlayer || Client == Room->WhitePlayer)) || (Type == BlackPlayerType && Room->BlackPlayer == NULL) || (Type == WhitePlayerType && Room->WhitePlayer == NULL))
@@ -83,61 +200,42 @@ void GameServer::ChangeSeat(GameServerClient* Client, PlayerType Type)
         else if (Client == Room->WhitePlayer)
           Room->WhitePlayer = NULL;
         else
-          Room->Observers.remove(Client);
+          RemoveRoomObserver(Room, Client);
         if (Type == BlackPlayerType)
           Room->BlackPlayer = Client;
         else if (Type == WhitePlayerType)
           Room->WhitePlayer = Client;
         else if (Type == ObserverType)
-            Room->Observers.push_back(Client);
+          AddRoomObserver(Room, Client);
+        IndexRoom(Room);
 
         /* Notify the room's players */
-        if (Room->WhitePlayer != NULL)
-          Room->WhitePlayer->SendPlayerType(Client->Id,Type);
-        if (Room->BlackPlayer != NULL)
-          Room->BlackPlayer->SendPlayerType(Client->Id,Type);
-        list<GameServerClient*>::iterator it;
-        for (it = Room->Observers.begin(); it != Room->Observers.end(); it++)
-          (*it)->SendPlayerType(Client->Id,Type);
+        GameServerMessage Message(ND_PlayerType);
+        Message.AddInteger(Client->Id);
+        Message.AddInteger(Type);
+        SendToRoom(Room, Message);
       }
+      UnlockRoom(Room);
     }
-    ReleaseMutex(Mutex);
   }
 }
 
-GameServerRoom* GameServer::CreateRoom(GameServerClient* Client, string Name)
+unsigned int GameServer::CreateRoom(GameServerClient* Client, string Name)
 {
-  GameServerRoom* Room = NULL;
-  if (Client != NULL && WaitForSingleObject(Mutex,INFINITE) == WAIT_OBJECT_0)
+  unsigned int Result = 0;
+  if (Client != NULL && Upstream.empty() && Lock())
   {
-    if (RoomIdCounter == UINT_MAX)
-      RoomIdCounter = 1;
-    else
-      RoomIdCounter++;
-
-    /* Create a new room */
-    Room = new GameServerRoom;
-    Room->Id = RoomIdCounter;
-    Room->Private = false;
-    Room->Paused = false;
-    Room->Started = false;
-    Room->StartTimestamp = 0;
-    Room->Name = Name;
-    Room->Owner = Client;
-    Room->BlackPlayer = NULL;
-    Room->WhitePlayer = NULL;
-
-    /* Add to the list */
-    Rooms.push_back(Room);
-
-    ReleaseMutex(Mutex);
+    GameServerRoom* Room = NewRoom(Client, Name);
+    if (Room != NULL)
+      Result = Room->Id;
+    Unlock();
   }
-  return Room;
+  return Result;
 }
 
 void GameServer::EndGame(GameServerRoom* Room)
 {
-  if (Room != NULL && WaitForSingleObject(Mutex,INFINITE) == WAIT_OBJECT_0)
+  if (Room != NULL && !Post(Room, EndGameCommand) && LockRoom(Room))
   {
     if (Room->Started)
       /* Notify observers */
@@ -146,155 +244,139 @@ void GameServer::EndGame(GameServerRoom* Room)
     /* Update room */
     Room->Started = false;
     Room->StartTimestamp = 0;
+    InvalidateGameData(Room);
+    StopClock(Room);
+    IndexRoom(Room);
 
-    ReleaseMutex(Mutex);
-  }
-}
-
-GameServerClient* GameServer::FindPlayer(unsigned int Id)
-{
-  GameServerClient* Result = NULL;
-  if (WaitForSingleObject(Mutex,INFINITE) == WAIT_OBJECT_0)
-  {
-    list<GameServerClient*>::iterator it;
-    for (it = Clients.begin(); it != Clients.end(); it++)
-      if ((*it)->Id == Id)
-        Result = (*it);
-    ReleaseMutex(Mutex);
+    UnlockRoom(Room);
   }
-  return Result;
 }
 
 GameServerRoom* GameServer::FindRoom(unsigned int Id)
 {
   GameServerRoom* Result = NULL;
-  if (WaitForSingleObject(Mutex,INFINITE) == WAIT_OBJECT_0)
+  if (Lock())
   {
-    list<GameServerRoom*>::iterator it;
-    for (it = Rooms.begin(); it != Rooms.end(); it++)
-      if ((*it)->Id == Id)
-        Result = (*it);
-    ReleaseMutex(Mutex);
+    GameServerRoom** Room = Rooms.Find(Id);
+    if (Room != NULL)
+      Result = *Room;
+    Unlock();
   }
   return Result;
 }
 
-list<GameServerClientInfo*>* GameServer::GetClients()
+GameServerMetrics GameServer::GetMetrics()
 {
-  list<GameServerClientInfo*>* List = new list<GameServerClientInfo*>;
-  if (WaitForSingleObject(Mutex,1000) == WAIT_OBJECT_0)
+  GameServerMetrics Metrics;
+  Metrics.Clients = 0;
+  Metrics.Rooms = 0;
+  Metrics.LockCount = 0;
+  Metrics.LockTime = 0;
+  Metrics.MaxLockTime = 0;
+
+  /* The lobby's counts come from the snapshot, the rest are counters */
+  GameServerSnapshot* Current = AcquireSnapshot();
+  if (Current != NULL)
   {
-    list<GameServerClient*>::iterator it;
-    for (it = Clients.begin(); it != Clients.end(); it++)
-    {
-      GameServerClientInfo* Info = new GameServerClientInfo;
-      Info->Id = (*it)->Id;
-      Info->Name = (*it)->Name;
-      Info->Ready = (*it)->Ready;
-      Info->RoomId = ((*it)->Room != NULL ? (*it)->Room->Id : 0);
-      Info->Synchronised = (*it)->Synchronised;
-      if ((*it)->Room != NULL && (*it) == (*it)->Room->WhitePlayer)
-        Info->Type = WhitePlayerType;
-      else if ((*it)->Room != NULL && (*it) == (*it)->Room->BlackPlayer)
-        Info->Type = BlackPlayerType;
-      else
-        Info->Type = ObserverType;
-      Info->Version = (*it)->Version;
-      Info->ConnectionTime = (*it)->ConnectionTime();
-      List->push_back(Info);
-    }
-    ReleaseMutex(Mutex);
+    Metrics.Clients = Current->Clients.size();
+    Metrics.Rooms = Current->Rooms.size();
+    Metrics.LockCount = Current->LockCount;
+    Metrics.LockTime = Current->LockTime;
+    Metrics.MaxLockTime = Current->MaxLockTime;
+    ReleaseSnapshot(Current);
+  }
+  Metrics.QueuedMessages = GameServerClient::QueuedMessages;
+  Metrics.QueuedBytes = GameServerClient::QueuedBytes;
+  Metrics.MaxQueuedBytes = GameServerClient::MaxQueuedBytes;
+  Metrics.QueueOverflows = GameServerClient::Overflows;
+  Metrics.DroppedMessages = GameServerClient::DroppedMessages;
+  Metrics.CoalescedMessages = GameServerClient::CoalescedMessages;
+  Metrics.GameDataHits = GameDataHits;
+  Metrics.GameDataRequests = GameDataRequests;
+  Metrics.RejectedMoves = RejectedMoves;
+  Metrics.ReclaimedSessions = ReclaimedSessions;
+  Metrics.AcceptedConnections = AcceptedConnections;
+  Metrics.MaxAcceptBatch = MaxAcceptBatch;
+  Metrics.LobbySnapshots = LobbySnapshots;
+  Metrics.CompressedBlobs = CompressedBlobs;
+  Metrics.CompressionRatio = (CompressionInput > 0 ? (unsigned long)(CompressionOutput * 100 / CompressionInput) : 0);
+  Metrics.CompressionCost = (CompressedBlobs > 0 ? (unsigned long)(CompressionTime / CompressedBlobs) : 0);
+  for (unsigned int i = 0; i < GameServerMessage::TypeCount; i++)
+  {
+    Metrics.SentMessages[i] = GameServerClient::SentMessages[i];
+    Metrics.SendCalls[i] = GameServerClient::SendCalls[i];
   }
-  return List;
+  return Metrics;
 }
 
-list<GameServerRoomInfo*>* GameServer::GetRooms()
+void GameServer::JoinRoom(GameServerClient* Client, unsigned int RoomId)
 {
-  list<GameServerRoomInfo*>* List = new list<GameServerRoomInfo*>;
-  if (WaitForSingleObject(Mutex,1000) == WAIT_OBJECT_0)
+  if (Client != NULL && Lock())
   {
-    list<GameServerRoom*>::iterator it;
-    for (it = Rooms.begin(); it != Rooms.end(); it++)
+    /* A relay's clients join its mirror of the upstream room */
+    if (!Upstream.empty())
+      RoomId = MirrorRoom(Client, RoomId);
+
+    /* The room is looked up by id so that it can't be deleted meanwhile */
+    GameServerRoom** Found = Rooms.Find(RoomId);
+    if (Found == NULL)
     {
-      GameServerRoomInfo* Info = new GameServerRoomInfo;
-      Info->Id = (*it)->Id;
-      Info->Name = (*it)->Name;
-      Info->Private = (*it)->Private;
-      Info->Paused = (*it)->Paused;
-      Info->Started = (*it)->Started;
-      if ((*it)->Started)
-      {
-        unsigned int TickCount = GetTickCount();
-        Info->Time = (TickCount > (*it)->StartTimestamp ? TickCount - (*it)->StartTimestamp : UINT_MAX - (*it)->StartTimestamp + TickCount);
-      }
-      else
-        Info->Time = 0;
-      Info->Players = (*it)->Observers.size()+((*it)->BlackPlayer != NULL ? 1 : 0)+((*it)->WhitePlayer != NULL ? 1 : 0);
-      List->push_back(Info);
+      Unlock();
+      return;
     }
-    ReleaseMutex(Mutex);
-  }
-  return List;
-}
+    GameServerRoom* Room = *Found;
+    LockRoom(Room);
 
-void GameServer::JoinRoom(GameServerClient* Client, GameServerRoom* Room)
-{
-  if (Client != NULL && Room != NULL && WaitForSingleObject(Mutex,INFINITE) == WAIT_OBJECT_0)
-  {
     /* Notify the player that he his joining the room */
     Client->SendNotification(JoinedRoom);
 
     /* Notify the room's players that a player is joining */
-    if (Room->WhitePlayer != NULL)
-      Room->WhitePlayer->SendPlayerJoined(Client->Id, Client->Name);
-    if (Room->BlackPlayer != NULL)
-      Room->BlackPlayer->SendPlayerJoined(Client->Id, Client->Name);
-    list<GameServerClient*>::iterator it;
-    for (it = Room->Observers.begin(); it != Room->Observers.end(); it++)
-      (*it)->SendPlayerJoined(Client->Id, Client->Name);
-
-    /* Send info on the room to the player */
-    if (Room->WhitePlayer != NULL)
-    {
-      Client->SendPlayerJoined(Room->WhitePlayer->Id, Room->WhitePlayer->Name);
-      Client->SendPlayerType(Room->WhitePlayer->Id, WhitePlayerType);
-    }
-    if (Room->BlackPlayer != NULL)
-    {
-      Client->SendPlayerJoined(Room->BlackPlayer->Id, Room->BlackPlayer->Name);
-      Client->SendPlayerType(Room->BlackPlayer->Id, BlackPlayerType);
-    }
-    for (it = Room->Observers.begin(); it != Room->Observers.end(); it++)
-      Client->SendPlayerJoined((*it)->Id, (*it)->Name);
+    GameServerMessage Message(ND_PlayerJoined);
+    Message.AddInteger(Client->Id);
+    Message.AddString(Client->Name);
+    SendToRoom(Room, Message);
 
-    /* Add the player to the room */
-    Room->Observers.push_back(Client);
+    /* Send info on the room to the player and add him to the room */
+    SendRoomState(Room, Client);
+    AddRoomObserver(Room, Client);
     Client->Room = Room;
+    Client->Shard = Room->Shard;
     Client->Ready = false;
-    if (Room->Owner == Client)
-      Client->Synchronised = true;
-    else
-    {
-      Room->Owner->SendNetworkRequest(GameData);
-      Client->Synchronised = false;
-    }
 
     /* Notify the player if he is the room owner */
-    if (Room->Owner == Client)
+    if (Room->Owner == Client->Id)
       Client->SendHostChanged(Client->Id);
 
-    ReleaseMutex(Mutex);
+    /* Notify the lobby's subscribers */
+    PublishRoom(Room);
+
+    UnlockRoom(Room);
+    Unlock();
   }
 }
 
 void GameServer::LeaveRoom(GameServerClient* Client)
 {
-  if (Client != NULL && WaitForSingleObject(Mutex,INFINITE) == WAIT_OBJECT_0)
+  if (Client != NULL && Lock())
   {
     /* Find the room the player is in */
     GameServerRoom* Room = Client->Room;
-    if (Room != NULL)
+    if (Room != NULL && Client->Relaying)
     {
+      /* A relay isn't a member of the room, nobody is notified */
+      LockRoom(Room);
+      vector<GameServerClient*>::iterator it = find(Room->Relays.begin(), Room->Relays.end(), Client);
+      if (it != Room->Relays.end())
+        Room->Relays.erase(it);
+      Client->Room = NULL;
+      Client->Shard = NULL;
+      Client->Relaying = false;
+      UnlockRoom(Room);
+    }
+    else if (Room != NULL)
+    {
+      LockRoom(Room);
+
       /* Notify the player that he left the room */
       Client->SendNotification(LeftRoom);
 
@@ -304,8 +386,9 @@ void GameServer::LeaveRoom(GameServerClient* Client)
       else if (Room->BlackPlayer == Client)
         Room->BlackPlayer = NULL;
       else
-        Room->Observers.remove(Client);
+        RemoveRoomObserver(Room, Client);
       Client->Room = NULL;
+      Client->Shard = NULL;
       Client->Ready = false;
 
       /* Delete the room if there are no more players in it */
@@ -315,151 +398,467 @@ void GameServer::LeaveRoom(GameServerClient* Client)
           /* Notify observers */
           NotifyObservers(RoomGameEnded, Room);
 
-        Rooms.remove(Room);
-        delete Room;
+        RemoveRoom(Room);
+        UnlockRoom(Room);
+
+        /* Deleting a mirror waits for its relay's thread, which may be
+           connecting or waiting for the lobby, the listening thread does it.
+           An actor deletes itself once the commands already posted are run. */
+        if (Room->Relay != NULL)
+          ClosedMirrors.push_back(Room);
+        else if (!Post(Room, CloseCommand))
+          DeleteRoom(Room);
       }
       else
       {
         /* Change the room's owner */
-        if (Room->Owner == Client)
+        if (Room->Owner == Client->Id)
         {
+          GameServerClient* Owner;
           if (Room->WhitePlayer != NULL)
-            Room->Owner = Room->WhitePlayer;
+            Owner = Room->WhitePlayer;
           else if (Room->BlackPlayer != NULL)
-            Room->Owner = Room->BlackPlayer;
+            Owner = Room->BlackPlayer;
           else
-            Room->Owner = *(Room->Observers.begin());
+            Owner = Room->Observers.front();
           /* Notify the player that he is the new game host */
-          if (Room->Owner != NULL)
-            Room->Owner->SendHostChanged(Room->Owner->Id);
+          Room->Owner = Owner->Id;
+          Owner->SendHostChanged(Owner->Id);
         }
 
         /* Notify the room's players that a player left */
-        if (Room->WhitePlayer != NULL)
-          Room->WhitePlayer->SendPlayerLeft(Client->Id);
-        if (Room->BlackPlayer != NULL)
-          Room->BlackPlayer->SendPlayerLeft(Client->Id);
-        list<GameServerClient*>::iterator it;
-        for (it = Room->Observers.begin(); it != Room->Observers.end(); it++)
-          (*it)->SendPlayerLeft(Client->Id);
+        GameServerMessage Message(ND_PlayerLeft);
+        Message.AddInteger(Client->Id);
+        SendToRoom(Room, Message);
+        PublishRoom(Room);
+        IndexRoom(Room);
+        UnlockRoom(Room);
       }
     }
-    ReleaseMutex(Mutex);
+    Unlock();
   }
 }
 
-void GameServer::RemoveClient(GameServerClient* Client)
+void GameServer::QueryNames(GameServerClient* Client, NameQueryType Type, const string& Prefix, unsigned long Limit)
 {
-  if (Client != NULL && WaitForSingleObject(Mutex,INFINITE) == WAIT_OBJECT_0)
+  if (Client != NULL)
   {
-    Clients.remove(Client);
-    ReleaseMutex(Mutex);
+    vector<pair<unsigned int, string> > Results;
+    SearchNames(Type, Prefix, Limit, Results);
+
+    GameServerMessage Message(ND_NameQueryResult);
+    Message.AddInteger(Type);
+    Message.AddInteger(Results.size());
+    vector<pair<unsigned int, string> >::iterator it;
+    for (it = Results.begin(); it != Results.end(); it++)
+    {
+      Message.AddInteger(it->first);
+      Message.AddString(it->second);
+    }
+    Client->Send(Message);
   }
 }
 
-void GameServer::SendGameData(GameServerClient* Client, unsigned char* Data, unsigned long DataSize)
+void GameServer::QueryRooms(GameServerClient* Client, unsigned int Filters, unsigned long Offset, unsigned long Limit)
 {
-  if (Client != NULL && WaitForSingleObject(Mutex,INFINITE) == WAIT_OBJECT_0)
+  if (Client != NULL && Lock())
   {
-    GameServerRoom* Room = Client->Room;
-    if (Room != NULL)
+    if (Limit == 0 || Limit > MaxQueryLimit)
+      Limit = MaxQueryLimit;
+
+    /* Find the page's rooms by rank in the index of the filters, the rooms
+       can't be deleted while the lobby is locked */
+    vector<unsigned int> Page;
+    EnterCriticalSection(&IndexLock);
+    GameServerRankIndex& Index = RoomIndexes[Filters % IndexCount];
+    unsigned long Total = Index.Size();
+    for (unsigned long i = Offset; i < Total && Page.size() < Limit; i++)
+      Page.push_back(IndexedRooms[Index.Find(i)-1]);
+    LeaveCriticalSection(&IndexLock);
+
+    /* The page is sent with a single call, followed by the number of rooms matching */
+    GameServerMessage Result;
+    vector<unsigned int>::iterator it2;
+    for (it2 = Page.begin(); it2 != Page.end(); it2++)
     {
-      /* Forward to unsynchronised players */
-      if (Room->WhitePlayer != NULL && !Room->WhitePlayer->Synchronised)
+      GameServerRoom** Found = Rooms.Find(*it2);
+      if (Found != NULL)
       {
-        Room->WhitePlayer->SendGameData(Data,DataSize);
-        Room->WhitePlayer->Synchronised = true;
+        LockRoom(*Found);
+        Result.Append(GetRoomInfo(*Found));
+        UnlockRoom(*Found);
       }
-      if (Room->BlackPlayer != NULL && !Room->BlackPlayer->Synchronised)
+    }
+    GameServerMessage End(ND_RoomQueryResult);
+    End.AddInteger(Offset);
+    End.AddInteger(Page.size());
+    End.AddInteger(Total);
+    Result.Append(End);
+    Unlock();
+
+    Client->Send(Result);
+  }
+}
+
+void GameServer::RelayRoom(GameServerClient* Client, unsigned int RoomId)
+{
+  if (Client != NULL && Lock())
+  {
+    /* Anyone else is refused like for a room that doesn't exist */
+    GameServerRoom** Found = Rooms.Find(RoomId);
+    if (Found == NULL || find(RelayPeers.begin(), RelayPeers.end(), Client->GetAddress()) == RelayPeers.end())
+    {
+      /* Let the relay know that there is nothing to forward */
+      Client->SendNotification(LeftRoom);
+      Unlock();
+      return;
+    }
+    GameServerRoom* Room = *Found;
+    LockRoom(Room);
+
+    /* The relay gets what a joining observer would, up to a mark telling it
+       where the replay ends, then the room's broadcasts. A relay asking
+       again for the state is already forwarding the room. */
+    Client->SendRoomInfo(Room->Id, Room->Name, Room->Private, (Room->BlackPlayer != NULL ? 1 : 0) + (Room->WhitePlayer != NULL ? 1 : 0) + Room->Observers.size());
+    SendRoomState(Room, Client);
+    Client->SendNotification(RoomStateSent);
+    if (find(Room->Relays.begin(), Room->Relays.end(), Client) == Room->Relays.end())
+      Room->Relays.push_back(Client);
+    Client->Room = Room;
+    Client->Shard = Room->Shard;
+    Client->Relaying = true;
+    Client->Ready = false;
+
+    UnlockRoom(Room);
+    Unlock();
+  }
+}
+
+void GameServer::ReleaseSnapshot(GameServerSnapshot* Released)
+{
+  if (Released != NULL)
+  {
+    /* A replaced snapshot is freed by its last reader */
+    EnterCriticalSection(&SnapshotLock);
+    bool Unreferenced = (--Released->References == 0);
+    LeaveCriticalSection(&SnapshotLock);
+    if (Unreferenced)
+      delete Released;
+  }
+}
+
+void GameServer::RemovePlayer(GameServerClient* Client, unsigned int Id)
+{
+  /* The player is looked up and removed under the lobby lock so that it
+     can't be deleted meanwhile, only the room's owner can remove players */
+  if (Client != NULL && Lock())
+  {
+    GameServerClient** Found = Clients.Find(Id);
+    if (Found != NULL && Client->Room != NULL && Client->Id == Client->Room->Owner && (*Found)->Room == Client->Room)
+      LeaveRoom(*Found);
+    Unlock();
+  }
+}
+
+void GameServer::RemoveClient(GameServerClient* Client)
+{
+  if (Client != NULL && Lock())
+  {
+    GameServerClient** Found = Clients.Find(Client->Id);
+    if (Found != NULL && *Found == Client)
+    {
+      Clients.Remove(Client->Id);
+      IndexName(PlayerNameIndex, Client->Id, Client->Name, "");
+      EnterCriticalSection(&TimerLock);
+      Timers->Cancel(&Client->Deadline);
+      LeaveCriticalSection(&TimerLock);
+    }
+    Unlock();
+    SubscribeLobby(Client, false);
+  }
+}
+
+void GameServer::RetireClient(GameServerClient* Client)
+{
+  /* Called by the client's own thread once it is disconnected */
+  if (Client != NULL && Lock())
+  {
+    RetiredClients.push_back(Client);
+    Unlock();
+  }
+}
+
+void GameServer::SearchNames(NameQueryType Type, const string& Prefix, unsigned long Limit, vector<pair<unsigned int, string> >& Results)
+{
+  if (Limit == 0 || Limit > MaxQueryLimit)
+    Limit = MaxQueryLimit;
+  if ((Type == RoomNameQuery || Type == PlayerNameQuery) && Lock())
+  {
+    /* The names starting with the prefix follow its first match, the rooms
+       and clients can't be deleted while the lobby is locked */
+    vector<unsigned int> Ids;
+    string Key = FoldName(Prefix);
+    EnterCriticalSection(&IndexLock);
+    set<pair<string, unsigned int> >& Index = (Type == RoomNameQuery ? RoomNameIndex : PlayerNameIndex);
+    set<pair<string, unsigned int> >::iterator it;
+    for (it = Index.lower_bound(make_pair(Key, 0U)); it != Index.end() && it->first.compare(0, Key.size(), Key) == 0 && Ids.size() < Limit; it++)
+      Ids.push_back(it->second);
+    LeaveCriticalSection(&IndexLock);
+
+    /* Return the names as they were given */
+    vector<unsigned int>::iterator it2;
+    for (it2 = Ids.begin(); it2 != Ids.end(); it2++)
+    {
+      if (Type == RoomNameQuery)
       {
-        Room->BlackPlayer->SendGameData(Data,DataSize);
-        Room->BlackPlayer->Synchronised = true;
+        GameServerRoom** Found = Rooms.Find(*it2);
+        if (Found != NULL)
+        {
+          GameServerRoom* Room = *Found;
+          LockRoom(Room);
+          Results.push_back(make_pair(Room->Relay != NULL ? Room->Relay->RoomId : Room->Id, Room->Name));
+          UnlockRoom(Room);
+        }
       }
-      list<GameServerClient*>::iterator it;
-      for (it = Room->Observers.begin(); it != Room->Observers.end(); it++)
+      else
       {
-        if (!(*it)->Synchronised)
-          (*it)->SendGameData(Data,DataSize);
-        (*it)->Synchronised = true;
+        GameServerClient** Found = Clients.Find(*it2);
+        if (Found != NULL)
+          Results.push_back(make_pair((*Found)->Id, (*Found)->Name));
       }
     }
-    ReleaseMutex(Mutex);
+    Unlock();
+  }
+}
+
+void GameServer::SearchSnapshot(GameServerSnapshot* Source, NameQueryType Type, const string& Prefix, unsigned long Limit, vector<pair<unsigned int, string> >& Results)
+{
+  if (Limit == 0 || Limit > MaxQueryLimit)
+    Limit = MaxQueryLimit;
+  if (Source == NULL || (Type != RoomNameQuery && Type != PlayerNameQuery))
+    return;
+
+  /* The snapshot isn't indexed, the names are matched one by one and sorted
+     like the lobby's index */
+  string Key = FoldName(Prefix);
+  vector<pair<string, pair<unsigned int, string> > > Matches;
+  if (Type == RoomNameQuery)
+  {
+    vector<GameServerRoomInfo>::iterator it;
+    for (it = Source->Rooms.begin(); it != Source->Rooms.end(); it++)
+    {
+      string Name = FoldName(it->Name);
+      if (Name.compare(0, Key.size(), Key) == 0)
+        Matches.push_back(make_pair(Name, make_pair(it->Id, it->Name)));
+    }
+  }
+  else
+  {
+    vector<GameServerClientInfo>::iterator it;
+    for (it = Source->Clients.begin(); it != Source->Clients.end(); it++)
+    {
+      string Name = FoldName(it->Name);
+      if (Name.compare(0, Key.size(), Key) == 0)
+        Matches.push_back(make_pair(Name, make_pair(it->Id, it->Name)));
+    }
+  }
+  sort(Matches.begin(), Matches.end());
+  for (unsigned int i = 0; i < Matches.size() && i < Limit; i++)
+    Results.push_back(Matches[i].second);
+}
+
+void GameServer::SendGameData(GameServerClient* Client, unsigned char* Data, unsigned long DataSize)
+{
+  if (Client != NULL)
+  {
+    /* The data is compressed by the client's reader, before being posted to
+       the room or taking its lock */
+    GameServerMessage Message(ND_GameData);
+    Message.AddInteger(DataSize);
+    Message.AddBytes(Data, DataSize);
+    CompressGameData(Message, Data, DataSize);
+    if (!Post(Client->Room, GameDataCommand, Client, 0, 0, "", &Message))
+      ForwardGameData(Client, Message);
   }
 }
 
 void GameServer::SendMessage(GameServerClient* Client, char* Message)
 {
-  if (Client != NULL && Message != NULL && WaitForSingleObject(Mutex,INFINITE) == WAIT_OBJECT_0)
+  if (Client != NULL && Message != NULL && !Post(Client->Room, MessageCommand, Client, 0, 0, Message))
   {
-    GameServerRoom* Room = Client->Room;
+    GameServerRoom* Room = LockRoom(Client);
     if (Room != NULL)
     {
       /* Forward to the entire room */
-      if (Room->WhitePlayer != NULL)
-        Room->WhitePlayer->SendMessage(Client->Id,Message);
-      if (Room->BlackPlayer != NULL)
-        Room->BlackPlayer->SendMessage(Client->Id,Message);
-      list<GameServerClient*>::iterator it;
-      for (it = Room->Observers.begin(); it != Room->Observers.end(); it++)
-        (*it)->SendMessage(Client->Id,Message);
+      GameServerMessage Data(ND_Message);
+      Data.AddInteger(Client->Id);
+      Data.AddString(Message);
+      SendToRoom(Room, Data);
+      UnlockRoom(Room);
     }
-    ReleaseMutex(Mutex);
   }
 }
 
-void GameServer::SendMove(GameServerRoom* Room, unsigned long Data)
+void GameServer::SendMove(GameServerClient* Client, unsigned long Data)
 {
-  if (Room != NULL && WaitForSingleObject(Mutex,INFINITE) == WAIT_OBJECT_0)
+  if (Client != NULL && !Post(Client->Room, MoveCommand, Client, Data))
   {
-    /* Forward to the entire room */
-    if (Room->WhitePlayer != NULL)
-      Room->WhitePlayer->SendMove(Data);
-    if (Room->BlackPlayer != NULL)
-      Room->BlackPlayer->SendMove(Data);
-    list<GameServerClient*>::iterator it;
-    for (it = Room->Observers.begin(); it != Room->Observers.end(); it++)
-      (*it)->SendMove(Data);
-    ReleaseMutex(Mutex);
+    GameServerRoom* Room = LockRoom(Client);
+    if (Room != NULL)
+    {
+      /* Only the players move, the seats are checked once the previous commands ran */
+      if (Client != Room->WhitePlayer && Client != Room->BlackPlayer)
+      {
+        UnlockRoom(Room);
+        return;
+      }
+
+      /* Only forward legal moves made by the player whose turn it is */
+      if (Room->Board != NULL && Room->Started)
+      {
+        ChessBoard::Color Side = (Client == Room->WhitePlayer ? ChessBoard::White : ChessBoard::Black);
+        if (Side != Room->Board->GetSideToMove() || !Room->Board->MakeMove(Data & 0xFF, (Data >> 8) & 0xFF))
+        {
+          InterlockedIncrement(&RejectedMoves);
+          UnlockRoom(Room);
+          return;
+        }
+      }
+
+      /* Forward to the entire room */
+      GameServerMessage Message(ND_Move);
+      Message.AddInteger(Data);
+      SendToRoom(Room, Message);
+      JournalGameData(Room, Message);
+
+      /* The other player's clock starts */
+      if (Room->Started)
+        SwitchClock(Room);
+
+      /* Checkmate or stalemate, a stalemate is a draw */
+      if (Room->Board != NULL && Room->Started && Room->Board->IsGameOver())
+      {
+        SendNotification(Room, Room->Board->IsCheck() ? Checkmated : GameDrawed);
+        EndGame(Room);
+      }
+      UnlockRoom(Room);
+    }
   }
 }
 
 void GameServer::SendNotification(GameServerRoom* Room, NotificationType Notification)
 {
-  if (Room != NULL && WaitForSingleObject(Mutex,INFINITE) == WAIT_OBJECT_0)
+  if (Room != NULL && !Post(Room, NotificationCommand, NULL, Notification) && LockRoom(Room))
   {
     /* Forward to the entire room */
-    if (Room->WhitePlayer != NULL)
-      Room->WhitePlayer->SendNotification(Notification);
-    if (Room->BlackPlayer != NULL)
-      Room->BlackPlayer->SendNotification(Notification);
-    list<GameServerClient*>::iterator it;
-    for (it = Room->Observers.begin(); it != Room->Observers.end(); it++)
-      (*it)->SendNotification(Notification);
-    ReleaseMutex(Mutex);
+    if (Notification == TookbackMove && Room->Board != NULL && Room->Started)
+      Room->Board->Undo();
+    if (Room->Started)
+    {
+      if (Notification == TookbackMove)
+        SwitchClock(Room);
+      else if (Notification == GamePaused)
+        StopClock(Room);
+      else if (Notification == GameResumed)
+        ResumeClock(Room);
+    }
+
+    GameServerMessage Message(ND_Notification);
+    Message.AddInteger(Notification);
+    SendToRoom(Room, Message);
+    if (Notification == TookbackMove)
+      JournalGameData(Room, Message);
+    else
+      InvalidateGameData(Room);
+    UnlockRoom(Room);
+  }
+}
+
+void GameServer::SendPlayerNotification(GameServerClient* Client, NotificationType Notification)
+{
+  if (Client != NULL && !Post(Client->Room, PlayerNotificationCommand, Client, Notification))
+  {
+    GameServerRoom* Room = LockRoom(Client);
+    if (Room != NULL)
+    {
+      /* Only the players notify their room */
+      if (Client == Room->WhitePlayer || Client == Room->BlackPlayer)
+      {
+        switch (Notification)
+        {
+          case IAmReady:
+          {
+            SetReady(Client);
+            break;
+          }
+          case IResign:
+          {
+            SendNotification(Room, Resigned);
+            EndGame(Room);
+            break;
+          }
+          case GamePaused:
+          {
+            Room->Paused = true;
+            SendNotification(Room, GamePaused);
+            break;
+          }
+          case GameResumed:
+          {
+            Room->Paused = false;
+            SendNotification(Room, GameResumed);
+            break;
+          }
+          case DrawRequestAccepted:
+          {
+            SendNotification(Room, GameDrawed);
+            EndGame(Room);
+            break;
+          }
+          case TakebackRequestAccepted:
+          {
+            SendNotification(Room, TookbackMove);
+            break;
+          }
+          case GameEnded:
+          {
+            EndGame(Room);
+            break;
+          }
+          default:
+            SendNotification(Room, Notification);
+        }
+      }
+      UnlockRoom(Room);
+    }
   }
 }
 
 void GameServer::SendPromotion(GameServerRoom* Room, int Type)
 {
-  if (Room != NULL && WaitForSingleObject(Mutex,INFINITE) == WAIT_OBJECT_0)
+  if (Room != NULL && !Post(Room, PromotionCommand, NULL, Type) && LockRoom(Room))
   {
+    /* A promotion can only follow a move that promoted a pawn */
+    if (Room->Board != NULL && Room->Started && !Room->Board->Promote((ChessBoard::PieceType)Type))
+    {
+      UnlockRoom(Room);
+      return;
+    }
+
     /* Forward to the entire room */
-    if (Room->WhitePlayer != NULL)
-      Room->WhitePlayer->SendPromoteTo(Type);
-    if (Room->BlackPlayer != NULL)
-      Room->BlackPlayer->SendPromoteTo(Type);
-    list<GameServerClient*>::iterator it;
-    for (it = Room->Observers.begin(); it != Room->Observers.end(); it++)
-      (*it)->SendPromoteTo(Type);
-    ReleaseMutex(Mutex);
+    GameServerMessage Message(ND_PromoteTo);
+    Message.AddInteger(Type);
+    SendToRoom(Room, Message);
+    JournalGameData(Room, Message);
+    UnlockRoom(Room);
   }
 }
 
 void GameServer::SendRequest(GameServerClient* Client, PlayerRequestType Request)
 {
-  if (Client != NULL && WaitForSingleObject(Mutex,INFINITE) == WAIT_OBJECT_0)
+  if (Client != NULL && !Post(Client->Room, RequestCommand, Client, Request))
   {
-    GameServerRoom* Room = Client->Room;
+    GameServerRoom* Room = LockRoom(Client);
     if (Room != NULL)
     {
       /* Forward to the opposing player */
@@ -467,142 +866,1164 @@ void GameServer::SendRequest(GameServerClient* Client, PlayerRequestType Request
         Room->BlackPlayer->SendPlayerRequest(Request);
       if (Client == Room->BlackPlayer && Room->WhitePlayer != NULL)
         Room->WhitePlayer->SendPlayerRequest(Request);
+      UnlockRoom(Room);
     }
-    ReleaseMutex(Mutex);
   }
 }
 
 void GameServer::SendRoomList(GameServerClient* Client)
 {
-  if (Client != NULL && WaitForSingleObject(Mutex,INFINITE) == WAIT_OBJECT_0)
+  if (Client != NULL && Lock())
   {
-    list<GameServerRoom*>::iterator it;
-    for (it = Rooms.begin(); it != Rooms.end(); it++)
-      Client->SendRoomInfo((*it)->Id,(*it)->Name,(*it)->Private,((*it)->BlackPlayer != NULL ? 1 : 0) + ((*it)->WhitePlayer != NULL ? 1 : 0) + (*it)->Observers.size());
-    ReleaseMutex(Mutex);
+    /* The snapshot is only rebuilt when a room changed since the last one,
+       a change made meanwhile by a relay makes the next request rebuild it */
+    LONG Revision = LobbyRevision;
+    if (Revision != SnapshotRevision)
+    {
+      LobbySnapshot = GameServerMessage();
+      for (unsigned int i = 0; i < Rooms.Size(); i++)
+      {
+        GameServerRoom* Room = Rooms[i];
+        LockRoom(Room);
+        LobbySnapshot.Append(GetRoomInfo(Room));
+        UnlockRoom(Room);
+      }
+      SnapshotRevision = Revision;
+      LobbySnapshots++;
+    }
+    GameServerMessage Snapshot = LobbySnapshot;
+    Unlock();
+
+    /* The whole list is sent with a single call */
+    if (!Snapshot.GetData().empty())
+      Client->Send(Snapshot);
   }
 }
 
-void GameServer::SendTime(GameServerRoom* Room, unsigned int Id, unsigned long Time)
+void GameServer::SendTime(GameServerClient* Client, unsigned long Time)
 {
-  if (Room != NULL && WaitForSingleObject(Mutex,INFINITE) == WAIT_OBJECT_0)
+  GameServerRoom* Room;
+  if (Client != NULL && !Post(Client->Room, TimeCommand, Client, Time) && (Room = LockRoom(Client)) != NULL)
   {
-    /* Forward to the entire room */
-    if (Room->WhitePlayer != NULL && Room->WhitePlayer->Id != Id)
-      Room->WhitePlayer->SendTime(Id,Time);
-    if (Room->BlackPlayer != NULL && Room->BlackPlayer->Id != Id)
-      Room->BlackPlayer->SendTime(Id,Time);
-    list<GameServerClient*>::iterator it;
-    for (it = Room->Observers.begin(); it != Room->Observers.end(); it++)
-      (*it)->SendTime(Id,Time);
-    ReleaseMutex(Mutex);
+    /* Only the players send their time */
+    unsigned int Id = Client->Id;
+    if (Client != Room->WhitePlayer && Client != Room->BlackPlayer)
+    {
+      UnlockRoom(Room);
+      return;
+    }
+
+    /* The players' times only set their clocks before the game starts */
+    if (ServerClocks)
+    {
+      if (Room->Started)
+      {
+        UnlockRoom(Room);
+        return;
+      }
+      if (Room->WhitePlayer != NULL && Room->WhitePlayer->Id == Id)
+        Room->Clocks[0] = Time;
+      else if (Room->BlackPlayer != NULL && Room->BlackPlayer->Id == Id)
+        Room->Clocks[1] = Time;
+    }
+
+    /* Forward to the entire room, except the player the time belongs to */
+    GameServerMessage Message(ND_PlayerTime);
+    Message.AddInteger(Id);
+    Message.AddInteger(Time);
+    SendToRoom(Room, Message, Id);
+    UnlockRoom(Room);
   }
 }
 
 void GameServer::SetName(GameServerClient* Client, char* PlayerName)
 {
-  if (Client != NULL && PlayerName != NULL && WaitForSingleObject(Mutex,INFINITE) == WAIT_OBJECT_0)
+  if (Client != NULL && PlayerName != NULL && Lock())
   {
-    Client->Name = PlayerName;
+    IndexName(PlayerNameIndex, Client->Id, Client->Name, PlayerName);
     GameServerRoom* Room = Client->Room;
     if (Room != NULL)
     {
+      LockRoom(Room);
+      Client->Name = PlayerName;
+
       /* Forward to the entire room */
-      if (Room->WhitePlayer != NULL)
-        Room->WhitePlayer->SendName(Client->Id, Client->Name);
-      if (Room->BlackPlayer != NULL)
-        Room->BlackPlayer->SendName(Client->Id, Client->Name);
-      list<GameServerClient*>::iterator it;
-      for (it = Room->Observers.begin(); it != Room->Observers.end(); it++)
-        (*it)->SendName(Client->Id, Client->Name);
+      GameServerMessage Message(ND_Name);
+      Message.AddInteger(Client->Id);
+      Message.AddString(Client->Name);
+      SendToRoom(Room, Message);
+      UnlockRoom(Room);
     }
     else
+    {
+      Client->Name = PlayerName;
       Client->SendName(Client->Id, Client->Name);
-    ReleaseMutex(Mutex);
+    }
+    Unlock();
   }
 }
 
 void GameServer::SetReady(GameServerClient* Client)
 {
-  if (Client != NULL && WaitForSingleObject(Mutex,INFINITE) == WAIT_OBJECT_0)
+  if (Client != NULL && !Post(Client->Room, ReadyCommand, Client))
   {
-    /* Update player */
-    Client->Ready = true;
-
-    GameServerRoom* Room = Client->Room;
-    if (Room != NULL)
+    GameServerRoom* Room = LockRoom(Client);
+    if (Room != NULL && Client != Room->WhitePlayer && Client != Room->BlackPlayer)
+      UnlockRoom(Room);
+    else if (Room != NULL)
     {
+      /* Update player */
+      Client->Ready = true;
+
       /* Notify the room's players */
-      if (Room->WhitePlayer != NULL)
-        Room->WhitePlayer->SendPlayerReady(Client->Id);
-      if (Room->BlackPlayer != NULL)
-        Room->BlackPlayer->SendPlayerReady(Client->Id);
-      list<GameServerClient*>::iterator it;
-      for (it = Room->Observers.begin(); it != Room->Observers.end(); it++)
-        (*it)->SendPlayerReady(Client->Id);
+      GameServerMessage Message(ND_PlayerReady);
+      Message.AddInteger(Client->Id);
+      SendToRoom(Room, Message);
       if (Room->WhitePlayer != NULL && Room->WhitePlayer->Ready && Room->BlackPlayer != NULL && Room->BlackPlayer->Ready)
       {
         /* Update room players */
         Room->Started = true;
         Room->StartTimestamp = GetTickCount();
+        if (Room->Board != NULL)
+          Room->Board->Reset();
+        Room->ClockSide = 0;
+        ResumeClock(Room);
         Room->WhitePlayer->Ready = false;
         Room->BlackPlayer->Ready = false;
+        IndexRoom(Room);
 
         /* Notify the room's players */
-        Room->WhitePlayer->SendNotification(GameStarted);
-        Room->BlackPlayer->SendNotification(GameStarted);
-        list<GameServerClient*>::iterator it;
-        for (it = Room->Observers.begin(); it != Room->Observers.end(); it++)
-          (*it)->SendNotification(GameStarted);
+        GameServerMessage Started(ND_Notification);
+        Started.AddInteger(GameStarted);
+        SendToRoom(Room, Started);
+        InvalidateGameData(Room);
 
         /* Notify observers */
         NotifyObservers(RoomGameStarted, Room);
       }
+      UnlockRoom(Room);
     }
-    ReleaseMutex(Mutex);
   }
 }
 
+void GameServer::SubscribeLobby(GameServerClient* Client, bool Subscribe)
+{
+  if (Client != NULL)
+  {
+    EnterCriticalSection(&FeedLock);
+    bool Subscribed = Client->Subscribed;
+    if (Subscribe && !Subscribed)
+      Subscribers.push_back(Client);
+    else if (!Subscribe && Subscribed)
+      Subscribers.erase(find(Subscribers.begin(), Subscribers.end(), Client));
+    Client->Subscribed = Subscribe;
+    LeaveCriticalSection(&FeedLock);
+
+    /* The list is sent once subscribed, a room changing meanwhile is sent
+       again with its newer state */
+    if (Subscribe && !Subscribed)
+      SendRoomList(Client);
+  }
+}
+
+// Private static functions ----------------------------------------------------
+
+string GameServer::FoldName(const string& Name)
+{
+  string Result(Name);
+  for (unsigned int i = 0; i < Result.size(); i++)
+    Result[i] = tolower((unsigned char)Result[i]);
+  return Result;
+}
+
 // Private functions -----------------------------------------------------------
 
-unsigned int GameServer::Run()
+void GameServer::AcceptClient(SOCKET SocketId)
 {
-  /* Open a socket for incoming connections */
-  TCPServerSocket* Socket = new TCPServerSocket;
-  Socket->SetBlocking(false);
-  Socket->Open(Port);
+  /* The accepted socket inherits the listening socket's mode */
+  u_long NonBlocking = 0;
+  ioctlsocket(SocketId, FIONBIO, &NonBlocking);
 
-  while (IsActive() && Socket->IsOpened())
+  GameServerClient* Client = new GameServerClient(this, SocketId, 0);
+  if (Lock())
   {
-    /* Accept the next connection request */
-    SOCKET SocketId = Socket->Accept();
-    if (IsActive() && SocketId != INVALID_SOCKET)
+    /* The client's handle is its id */
+    Client->Id = Clients.Insert(Client);
+    if (Client->Id != 0)
     {
-      if (ClientIdCounter == UINT_MAX)
-        ClientIdCounter = 1;
+      /* Give the client a deadline to send its version */
+      Client->Deadline.Type = ClientTimer;
+      Client->Deadline.Id = Client->Id;
+      ScheduleClient(Client, HandshakeTimeout);
+    }
+    Unlock();
+  }
+
+  /* Start processing the client's data, distributing clients between the shards */
+  if (Client->Id == 0)
+  {
+    /* The server is full */
+    Client->Disconnect();
+    delete Client;
+  }
+  else if (Reactors.empty())
+  {
+    Writer->AddClient(Client, false);
+    Client->Start();
+  }
+  else
+  {
+    GameServerReactor* Reactor = Reactors[NextReactor];
+    NextReactor = (NextReactor + 1) % Reactors.size();
+    if (!Reactor->AddClient(Client))
+    {
+      /* Data already sent may still be pending on the reactor, its
+         completion drops the last reference */
+      Client->Disconnect();
+      if (Client->Reactor != NULL)
+        Reactor->Release(Client);
       else
-        ClientIdCounter++;
-      GameServerClient* Client = new GameServerClient(this, SocketId, ClientIdCounter);
-      if (WaitForSingleObject(Mutex,INFINITE) == WAIT_OBJECT_0)
+        delete Client;
+    }
+  }
+}
+
+void GameServer::AddRoomObserver(GameServerRoom* Room, GameServerClient* Client)
+{
+  Client->ObserverIndex = Room->Observers.size();
+  Room->Observers.push_back(Client);
+}
+
+GameServerSnapshot* GameServer::BuildSnapshot()
+{
+  if (!Lock(1000))
+    return NULL;
+  GameServerSnapshot* Result = new GameServerSnapshot;
+  Result->Timestamp = GetTickCount();
+  Result->References = 1;
+  Result->LockCount = LockCount;
+  Result->LockTime = (unsigned long)(LockTime * 1000 / TimerFrequency.QuadPart);
+  Result->MaxLockTime = (unsigned long)(MaxLockTime * 1000000 / TimerFrequency.QuadPart);
+  Result->Clients.resize(Clients.Size());
+  for (unsigned int i = 0; i < Clients.Size(); i++)
+  {
+    GameServerClient* Client = Clients[i];
+    GameServerClientInfo& Info = Result->Clients[i];
+    Info.Id = Client->Id;
+    Info.Name = Client->Name;
+    Info.Ready = Client->Ready;
+    Info.RoomId = 0;
+    Info.Synchronised = Client->Synchronised;
+    Info.Type = ObserverType;
+    GameServerRoom* Room = Client->Room;
+    if (Room != NULL && LockRoom(Room))
+    {
+      Info.RoomId = Room->Id;
+      if (Client == Room->WhitePlayer)
+        Info.Type = WhitePlayerType;
+      else if (Client == Room->BlackPlayer)
+        Info.Type = BlackPlayerType;
+      UnlockRoom(Room);
+    }
+    Info.Version = Client->Version;
+    Info.ConnectionTime = Client->ConnectionTime();
+  }
+  Result->Rooms.resize(Rooms.Size());
+  for (unsigned int i = 0; i < Rooms.Size(); i++)
+  {
+    GameServerRoom* Room = Rooms[i];
+    GameServerRoomInfo& Info = Result->Rooms[i];
+    LockRoom(Room);
+    Info.Id = Room->Id;
+    Info.Name = Room->Name;
+    Info.Private = Room->Private;
+    Info.Paused = Room->Paused;
+    Info.Started = Room->Started;
+    if (Room->Started)
+    {
+      unsigned int TickCount = GetTickCount();
+      Info.Time = (TickCount > Room->StartTimestamp ? TickCount - Room->StartTimestamp : UINT_MAX - Room->StartTimestamp + TickCount);
+    }
+    else
+      Info.Time = 0;
+    Info.Players = Room->Observers.size()+(Room->BlackPlayer != NULL ? 1 : 0)+(Room->WhitePlayer != NULL ? 1 : 0);
+    UnlockRoom(Room);
+  }
+  Unlock();
+  return Result;
+}
+
+void GameServer::RunRoom(GameServerRoom* Room)
+{
+  LONG Count = 0;
+  bool Closed = false;
+
+  /* Run a batch of commands, the room's lock is only needed because players
+     still join and leave the room from their own thread */
+  LockRoom(Room);
+  Room->Runner = GetCurrentThreadId();
+  GameServerCommand* Command;
+  while (Count < MaxRoomBatch && (Command = Room->Inbox.Pop()) != NULL)
+  {
+    Count++;
+
+    /* Ignore the commands of players that left the room after posting them */
+    GameServerClient* Client = Command->Client;
+    if (Client == NULL || Client->Room == Room)
+    {
+      switch (Command->Type)
+      {
+        case ChangeSeatCommand:
+          ChangeSeat(Client, (PlayerType)Command->Value);
+          break;
+        case CloseCommand:
+          Closed = true;
+          break;
+        case EndGameCommand:
+          EndGame(Room);
+          break;
+        case GameDataCommand:
+          ForwardGameData(Client, *Command->Message);
+          break;
+        case MessageCommand:
+          SendMessage(Client, (char*)Command->Data.c_str());
+          break;
+        case MoveCommand:
+          SendMove(Client, Command->Value);
+          break;
+        case NotificationCommand:
+          SendNotification(Room, (NotificationType)Command->Value);
+          break;
+        case PlayerNotificationCommand:
+          SendPlayerNotification(Client, (NotificationType)Command->Value);
+          break;
+        case PromotionCommand:
+          SendPromotion(Room, Command->Value);
+          break;
+        case ReadyCommand:
+          SetReady(Client);
+          break;
+        case RequestCommand:
+          SendRequest(Client, (PlayerRequestType)Command->Value);
+          break;
+        case TimeCommand:
+          SendTime(Client, Command->Value);
+          break;
+      }
+    }
+    if (Client != NULL)
+      Client->Reactor->Release(Client);
+    if (Command->Message != NULL)
+      delete Command->Message;
+    delete Command;
+  }
+  Room->Runner = 0;
+  UnlockRoom(Room);
+
+  /* Nobody can post to a closed room, it was removed from the lobby when empty */
+  if (Closed)
+    DeleteRoom(Room);
+  else if (InterlockedExchangeAdd(&Room->Pending, -Count) != Count)
+    /* Commands were posted while running, or the batch was full */
+    Schedule(Room);
+}
+
+void GameServer::Schedule(GameServerRoom* Room)
+{
+  /* Run the room on this thread if its shard can't take it */
+  if (!Room->Shard->Schedule(Room))
+    RunRoom(Room);
+}
+
+void GameServer::ScheduleClient(GameServerClient* Client, unsigned long Timeout)
+{
+  EnterCriticalSection(&TimerLock);
+  Timers->Schedule(&Client->Deadline, Timers->GetTick() + Timeout / TickDuration + 1);
+  LeaveCriticalSection(&TimerLock);
+}
+
+void GameServer::ScheduleClock(GameServerRoom* Room)
+{
+  EnterCriticalSection(&TimerLock);
+  Timers->Schedule(&Room->FlagTimer, Timers->GetTick() + Room->Clocks[Room->ClockSide] / TickDuration + 1);
+  LeaveCriticalSection(&TimerLock);
+}
+
+void GameServer::SendClock(GameServerRoom* Room, unsigned int Side)
+{
+  GameServerClient* Player = (Side == 0 ? Room->WhitePlayer : Room->BlackPlayer);
+  if (Player != NULL)
+  {
+    GameServerMessage Message(ND_PlayerTime);
+    Message.AddInteger(Player->Id);
+    Message.AddInteger(Room->Clocks[Side]);
+    SendToRoom(Room, Message);
+  }
+}
+
+void GameServer::SendRoomState(GameServerRoom* Room, GameServerClient* Client)
+{
+  /* Send the room's players */
+  if (Room->WhitePlayer != NULL)
+  {
+    Client->SendPlayerJoined(Room->WhitePlayer->Id, Room->WhitePlayer->Name);
+    Client->SendPlayerType(Room->WhitePlayer->Id, WhitePlayerType);
+  }
+  if (Room->BlackPlayer != NULL)
+  {
+    Client->SendPlayerJoined(Room->BlackPlayer->Id, Room->BlackPlayer->Name);
+    Client->SendPlayerType(Room->BlackPlayer->Id, BlackPlayerType);
+  }
+  vector<GameServerClient*>::iterator it;
+  for (it = Room->Observers.begin(); it != Room->Observers.end(); it++)
+    Client->SendPlayerJoined((*it)->Id, (*it)->Name);
+  if (Room->Relay != NULL)
+    Room->Relay->SendMembers(Client);
+
+  /* Send the game */
+  GameServerClient** Owner = Clients.Find(Room->Owner);
+  if (Room->Owner == Client->Id)
+    Client->Synchronised = true;
+  else if (Room->GameDataCached)
+  {
+    /* Catch up from the owner's last data */
+    Client->Send(Room->GameData);
+    vector<GameServerMessage>::iterator it2;
+    for (it2 = Room->Journal.begin(); it2 != Room->Journal.end(); it2++)
+      Client->Send(*it2);
+    Client->Synchronised = true;
+    InterlockedIncrement(&GameDataHits);
+  }
+  else
+  {
+    /* A mirror asks the upstream server instead of the owner */
+    if (Room->Relay != NULL)
+      Room->Relay->RequestState();
+    else if (Owner != NULL)
+      (*Owner)->SendNetworkRequest(GameData);
+    Room->RequestRevision = Room->Revision;
+    Client->Synchronised = false;
+    InterlockedIncrement(&GameDataRequests);
+  }
+}
+
+void GameServer::SendToRoom(GameServerRoom* Room, const GameServerMessage& Message, unsigned int ExceptId)
+{
+  /* The message is encoded once and shared by every player's queue */
+  if (Room->WhitePlayer != NULL && Room->WhitePlayer->Id != ExceptId)
+    Room->WhitePlayer->Send(Message);
+  if (Room->BlackPlayer != NULL && Room->BlackPlayer->Id != ExceptId)
+    Room->BlackPlayer->Send(Message);
+  vector<GameServerClient*>::iterator it;
+  for (it = Room->Observers.begin(); it != Room->Observers.end(); it++)
+    if ((*it)->Id != ExceptId)
+      (*it)->Send(Message);
+
+  /* The relays forward everything to their own observers */
+  for (it = Room->Relays.begin(); it != Room->Relays.end(); it++)
+    (*it)->Send(Message);
+}
+
+void GameServer::CompressGameData(GameServerMessage& Message, const unsigned char* Data, unsigned long DataSize)
+{
+  if (DataSize < MinCompressedSize)
+    return;
+
+  LARGE_INTEGER Start;
+  QueryPerformanceCounter(&Start);
+  uLongf CompressedSize = compressBound(DataSize);
+  string Buffer(CompressedSize, '\0');
+  bool Compressed = (compress2((Bytef*)&Buffer[0], &CompressedSize, Data, DataSize, Z_DEFAULT_COMPRESSION) == Z_OK && CompressedSize < DataSize);
+  LARGE_INTEGER End;
+  QueryPerformanceCounter(&End);
+
+  /* Data that doesn't shrink is sent as is to everyone */
+  if (Compressed)
+  {
+    GameServerMessage CompressedMessage(ND_CompressedGameData);
+    CompressedMessage.AddInteger(DataSize);
+    CompressedMessage.AddInteger(CompressedSize);
+    CompressedMessage.AddBytes(Buffer.data(), CompressedSize);
+    Message.SetCompressed(CompressedMessage);
+  }
+  InterlockedIncrement(&CompressedBlobs);
+  InterlockedExchangeAdd64(&CompressionInput, DataSize);
+  InterlockedExchangeAdd64(&CompressionOutput, (Compressed ? CompressedSize : DataSize));
+  InterlockedExchangeAdd64(&CompressionTime, (End.QuadPart - Start.QuadPart) * 1000000 / TimerFrequency.QuadPart);
+}
+
+void GameServer::InvalidateGameData(GameServerRoom* Room)
+{
+  /* Data already asked to the owner is now outdated as well */
+  Room->GameDataCached = false;
+  Room->GameData = GameServerMessage();
+  Room->Journal.clear();
+  Room->Revision++;
+}
+
+void GameServer::JournalGameData(GameServerRoom* Room, const GameServerMessage& Message)
+{
+  /* Without data from the owner there is nothing to catch up from, and past
+     a point asking the owner again is cheaper than replaying every move */
+  if (Room->GameDataCached && Room->Journal.size() < MaxJournalSize)
+  {
+    Room->Journal.push_back(Message);
+    Room->Revision++;
+  }
+  else
+    InvalidateGameData(Room);
+}
+
+void GameServer::ChargeClock(GameServerRoom* Room)
+{
+  /* Take the time elapsed since the clock was last charged from the running side */
+  DWORD Timestamp = GetTickCount();
+  unsigned long Elapsed = Timestamp - Room->ClockTimestamp;
+  unsigned long& Clock = Room->Clocks[Room->ClockSide];
+  Clock = (Elapsed < Clock ? Clock - Elapsed : 0);
+  Room->ClockTimestamp = Timestamp;
+}
+
+void GameServer::CheckClock(unsigned int RoomId)
+{
+  /* The room is looked up in the lobby in case it was deleted */
+  if (!Lock())
+    return;
+  GameServerRoom** Found = Rooms.Find(RoomId);
+  if (Found == NULL)
+  {
+    Unlock();
+    return;
+  }
+  GameServerRoom* Room = *Found;
+  LockRoom(Room);
+  Unlock();
+
+  if (Room->ClockRunning)
+  {
+    ChargeClock(Room);
+    if (Room->Clocks[Room->ClockSide] == 0)
+    {
+      /* The player's flag fell, the time left tells whose */
+      SendClock(Room, Room->ClockSide);
+      SendNotification(Room, FlagFell);
+      EndGame(Room);
+    }
+    else
+      ScheduleClock(Room);
+  }
+  UnlockRoom(Room);
+}
+
+void GameServer::CheckClient(unsigned int ClientId)
+{
+  if (Lock())
+  {
+    GameServerClient** Found = Clients.Find(ClientId);
+    if (Found != NULL)
+    {
+      GameServerClient* Client = *Found;
+      unsigned long Idle = GetTickCount() - Client->LastActivity;
+      if (!Client->IsConnected())
+      {
+        /* The client never sent its version */
+        InterlockedIncrement(&ReclaimedSessions);
+        Client->Close();
+      }
+      else if (Client->Room != NULL || Client->Subscribed)
+        /* Players waiting for an opponent and observers only listen, dead
+           peers among them are left to the keep-alives */
+        ScheduleClient(Client, IdleTimeout);
+      else if (Idle >= IdleTimeout)
       {
-        Clients.push_back(Client);
-        ReleaseMutex(Mutex);
+        /* Closing the socket makes the client's reader disconnect it */
+        InterlockedIncrement(&ReclaimedSessions);
+        Client->Close();
       }
+      else
+        ScheduleClient(Client, IdleTimeout - Idle);
+    }
+    Unlock();
+  }
+}
+
+void GameServer::CloseMirror(GameServerRoom* Room)
+{
+  /* The room may have been removed since its relay stopped */
+  GameServerRoom** Found = Rooms.Find(Room->Id);
+  if (Found == NULL || *Found != Room)
+    return;
+  LockRoom(Room);
+
+  /* Move the observers out of the room */
+  vector<GameServerClient*>::iterator it;
+  for (it = Room->Observers.begin(); it != Room->Observers.end(); it++)
+  {
+    (*it)->SendNotification(LeftRoom);
+    (*it)->Room = NULL;
+    (*it)->Shard = NULL;
+    (*it)->Ready = false;
+  }
+  Room->Observers.clear();
+
+  /* The relay's thread can't delete its own room, the listening thread does */
+  RemoveRoom(Room);
+  UnlockRoom(Room);
+  ClosedMirrors.push_back(Room);
+}
+
+void GameServer::DeleteClosedMirrors()
+{
+  vector<GameServerRoom*> Closed;
+  if (Lock())
+  {
+    Closed.swap(ClosedMirrors);
+    Unlock();
+  }
+
+  /* Deleting a mirror waits for its relay's thread, no lock is held */
+  vector<GameServerRoom*>::iterator it;
+  for (it = Closed.begin(); it != Closed.end(); it++)
+    if (!Post(*it, CloseCommand))
+      DeleteRoom(*it);
+}
+
+void GameServer::DeleteRoom(GameServerRoom* Room)
+{
+  /* Stop forwarding a mirrored room, the room isn't locked so the relay's thread can't be stuck on it */
+  if (Room->Relay != NULL)
+    delete Room->Relay;
+  EnterCriticalSection(&TimerLock);
+  Timers->Cancel(&Room->FlagTimer);
+  LeaveCriticalSection(&TimerLock);
+  DeleteCriticalSection(&Room->Lock);
+  if (Room->Board != NULL)
+    delete Room->Board;
+  delete Room;
+}
+
+void GameServer::ForwardGameData(GameServerClient* Client, const GameServerMessage& Message)
+{
+  GameServerRoom* Room = LockRoom(Client);
+  if (Room != NULL)
+  {
+    /* Keep the owner's data unless the game changed since it was asked for */
+    if (Client->Id == Room->Owner && Room->Revision == Room->RequestRevision)
+    {
+      Room->GameData = Message;
+      Room->GameDataCached = true;
+    }
+
+    /* Forward to unsynchronised players */
+    if (Room->WhitePlayer != NULL && !Room->WhitePlayer->Synchronised)
+    {
+      Room->WhitePlayer->Send(Message);
+      Room->WhitePlayer->Synchronised = true;
     }
+    if (Room->BlackPlayer != NULL && !Room->BlackPlayer->Synchronised)
+    {
+      Room->BlackPlayer->Send(Message);
+      Room->BlackPlayer->Synchronised = true;
+    }
+    vector<GameServerClient*>::iterator it;
+    for (it = Room->Observers.begin(); it != Room->Observers.end(); it++)
+    {
+      if (!(*it)->Synchronised)
+        (*it)->Send(Message);
+      (*it)->Synchronised = true;
+    }
+    for (it = Room->Relays.begin(); it != Room->Relays.end(); it++)
+    {
+      if (!(*it)->Synchronised)
+        (*it)->Send(Message);
+      (*it)->Synchronised = true;
+    }
+    UnlockRoom(Room);
+  }
+}
+
+GameServerMessage GameServer::GetRoomInfo(GameServerRoom* Room)
+{
+  GameServerMessage Message(ND_RoomInfo);
+  if (Room->Relay != NULL)
+  {
+    /* A mirror is known by its upstream id */
+    Message.AddInteger(Room->Relay->RoomId);
+    Message.AddString(Room->Name);
+    Message.AddInteger(Room->Private);
+    Message.AddInteger(Room->Relay->GetMemberCount() + Room->Observers.size());
+  }
+  else
+  {
+    Message.AddInteger(Room->Id);
+    Message.AddString(Room->Name);
+    Message.AddInteger(Room->Private);
+    Message.AddInteger((Room->BlackPlayer != NULL ? 1 : 0) + (Room->WhitePlayer != NULL ? 1 : 0) + Room->Observers.size());
+  }
+  return Message;
+}
+
+void GameServer::IndexName(set<pair<string, unsigned int> >& Index, unsigned int Id, const string& Before, const string& After)
+{
+  /* Nameless rooms and clients aren't indexed */
+  string From = FoldName(Before);
+  string To = FoldName(After);
+  if (From != To)
+  {
+    EnterCriticalSection(&IndexLock);
+    if (!From.empty())
+      Index.erase(make_pair(From, Id));
+    if (!To.empty())
+      Index.insert(make_pair(To, Id));
+    LeaveCriticalSection(&IndexLock);
+  }
+}
+
+void GameServer::IndexRoom(GameServerRoom* Room, bool Removed)
+{
+  /* The players can't sit in a relay's mirrors */
+  unsigned int Filters = 0;
+  if (!Room->Private)
+    Filters |= PublicRooms;
+  if (!Room->Started)
+    Filters |= WaitingRooms;
+  if (Room->Relay == NULL && (Room->WhitePlayer == NULL || Room->BlackPlayer == NULL))
+    Filters |= OpenRooms;
+  if (Removed || !Room->Indexed || Filters != Room->Filters)
+  {
+    /* The rooms are indexed by slot, which only one room holds at a time */
+    unsigned int Slot = Room->Id & GameServerSlotMap<GameServerRoom*>::MaxSize;
+    EnterCriticalSection(&IndexLock);
+    if (IndexedRooms.size() < Slot)
+      IndexedRooms.resize(Slot, 0);
+    IndexedRooms[Slot-1] = Room->Id;
+    for (unsigned int i = 0; i < IndexCount; i++)
+    {
+      bool Before = (Room->Indexed && (Room->Filters & i) == i);
+      bool After = (!Removed && (Filters & i) == i);
+      if (Before && !After)
+        RoomIndexes[i].Erase(Slot);
+      else if (After && !Before)
+        RoomIndexes[i].Insert(Slot);
+    }
+    LeaveCriticalSection(&IndexLock);
+    Room->Filters = Filters;
+    Room->Indexed = !Removed;
+  }
+}
+
+bool GameServer::Lock(DWORD Timeout)
+{
+  if (Timeout == INFINITE)
+    EnterCriticalSection(&LobbyLock);
+  else
+  {
+    /* Critical sections can't time out, poll until the delay expires */
+    DWORD Timestamp = GetTickCount();
+    while (!TryEnterCriticalSection(&LobbyLock))
+    {
+      if (GetTickCount() - Timestamp >= Timeout)
+        return false;
+      Sleep(1);
+    }
+  }
+
+  /* Measure how long the outermost lock is held */
+  if (LockDepth++ == 0)
+    QueryPerformanceCounter(&LockTimestamp);
+  return true;
+}
+
+unsigned int GameServer::MirrorRoom(GameServerClient* Client, unsigned int UpstreamId)
+{
+  /* The first client to join an upstream room creates its mirror */
+  map<unsigned int, unsigned int>::iterator it = Mirrors.find(UpstreamId);
+  if (it != Mirrors.end())
+    return it->second;
+
+  /* Each mirror has its own thread and upstream connection, rooms that don't
+     exist upstream are torn down once rejected */
+  if (Mirrors.size() >= MaxMirrors)
+    return 0;
+  GameServerRoom* Room = NewRoom(Client, "");
+  if (Room == NULL)
+    return 0;
+  Room->Owner = 0;
+  Room->Relay = new GameServerRelay(this, Room, Upstream, UpstreamId);
+  Mirrors[UpstreamId] = Room->Id;
+  return Room->Id;
+}
+
+GameServerRoom* GameServer::NewRoom(GameServerClient* Client, string Name)
+{
+  /* Create a new room */
+  GameServerRoom* Room = new GameServerRoom;
+  Room->Id = 0;
+  Room->Private = false;
+  Room->Paused = false;
+  Room->Started = false;
+  Room->StartTimestamp = 0;
+  Room->Name = Name;
+  Room->Shard = (Scheduler != NULL ? Scheduler : Client->Reactor);
+  Room->Owner = Client->Id;
+  Room->BlackPlayer = NULL;
+  Room->WhitePlayer = NULL;
+  InitializeCriticalSection(&Room->Lock);
+  Room->Board = (ValidateMoves ? new ChessBoard : NULL);
+  Room->Relay = NULL;
+  Room->Filters = 0;
+  Room->Indexed = false;
+  Room->GameDataCached = false;
+  Room->Revision = 0;
+  Room->RequestRevision = 0;
+  Room->Clocks[0] = 0;
+  Room->Clocks[1] = 0;
+  Room->ClockSide = 0;
+  Room->ClockRunning = false;
+  Room->ClockTimestamp = 0;
+  TimingWheel::Initialise(&Room->FlagTimer);
+  Room->Server = this;
+  Room->Pending = 0;
+  Room->Runner = 0;
+
+  /* Add to the list, the room's handle is its id */
+  Room->Id = Rooms.Insert(Room);
+  InterlockedIncrement(&LobbyRevision);
+  Room->FlagTimer.Type = ClockTimer;
+  Room->FlagTimer.Id = Room->Id;
+  if (Room->Id == 0)
+  {
+    DeleteRoom(Room);
+    return NULL;
+  }
+  IndexRoom(Room);
+  IndexName(RoomNameIndex, Room->Id, "", Room->Name);
+  return Room;
+}
+
+void GameServer::Unlock()
+{
+  if (--LockDepth == 0)
+  {
+    LARGE_INTEGER Timestamp;
+    QueryPerformanceCounter(&Timestamp);
+    LONGLONG Time = Timestamp.QuadPart - LockTimestamp.QuadPart;
+    LockCount++;
+    LockTime += Time;
+    if (Time > MaxLockTime)
+      MaxLockTime = Time;
+  }
+  LeaveCriticalSection(&LobbyLock);
+}
+
+GameServerRoom* GameServer::LockRoom(GameServerClient* Client)
+{
+  /* The player may be moved out of the room while waiting for its lock */
+  GameServerRoom* Room = Client->Room;
+  while (Room != NULL)
+  {
+    LockRoom(Room);
+    if (Client->Room == Room)
+      break;
+    UnlockRoom(Room);
+    Room = Client->Room;
+  }
+  return Room;
+}
+
+bool GameServer::LockRoom(GameServerRoom* Room)
+{
+  EnterCriticalSection(&Room->Lock);
+  return true;
+}
+
+void GameServer::UnlockRoom(GameServerRoom* Room)
+{
+  LeaveCriticalSection(&Room->Lock);
+}
+
+void GameServer::ProcessTimers()
+{
+  vector<TimingWheelTimer*> Expired;
+  vector<pair<unsigned int, unsigned int> > Timeouts;
+  EnterCriticalSection(&TimerLock);
+  DWORD Timestamp = GetTickCount();
+  unsigned long Ticks = (Timestamp - TimerTimestamp) / TickDuration;
+  TimerTimestamp += Ticks * TickDuration;
+  Timers->Advance(Timers->GetTick() + Ticks, Expired);
+
+  /* The timers belong to clients and rooms that may be deleted once the wheel is unlocked */
+  vector<TimingWheelTimer*>::iterator it0;
+  for (it0 = Expired.begin(); it0 != Expired.end(); it0++)
+    Timeouts.push_back(make_pair((*it0)->Type, (*it0)->Id));
+  LeaveCriticalSection(&TimerLock);
+
+  /* Handle the expired timers without holding the wheel */
+  vector<pair<unsigned int, unsigned int> >::iterator it1;
+  for (it1 = Timeouts.begin(); it1 != Timeouts.end(); it1++)
+  {
+    if (it1->first == ClockTimer)
+      CheckClock(it1->second);
+    else
+      CheckClient(it1->second);
+  }
+}
+
+void GameServer::PublishRoom(GameServerRoom* Room, bool Removed)
+{
+  /* The lobby's snapshot is outdated */
+  InterlockedIncrement(&LobbyRevision);
+
+  /* The message is built once and shared by every subscriber's queue */
+  GameServerMessage Message;
+  if (Removed)
+  {
+    Message = GameServerMessage(ND_RoomRemoved);
+    Message.AddInteger(Room->Relay != NULL ? Room->Relay->RoomId : Room->Id);
+  }
+  else
+    Message = GetRoomInfo(Room);
+
+  EnterCriticalSection(&FeedLock);
+  vector<GameServerClient*>::iterator it;
+  for (it = Subscribers.begin(); it != Subscribers.end(); it++)
+    (*it)->Send(Message);
+  LeaveCriticalSection(&FeedLock);
+}
+
+void GameServer::ResumeClock(GameServerRoom* Room)
+{
+  /* Games without a time limit have no clock */
+  if (ServerClocks && Room->Clocks[0] > 0 && Room->Clocks[1] > 0 && !Room->ClockRunning)
+  {
+    Room->ClockRunning = true;
+    Room->ClockTimestamp = GetTickCount();
+    ScheduleClock(Room);
+  }
+}
+
+bool GameServer::Post(GameServerRoom* Room, GameServerCommandType Type, GameServerClient* Client, unsigned long Value, unsigned long Time, const string& Data, const GameServerMessage* Message)
+{
+  /* Commands are run directly when the room is already running on this thread */
+  if (!RoomActors || Room == NULL || Room->Runner == GetCurrentThreadId())
+    return false;
+
+  GameServerCommand* Command = new GameServerCommand;
+  Command->Type = Type;
+  Command->Client = Client;
+  Command->Value = Value;
+  Command->Time = Time;
+  Command->Data = Data;
+  Command->Message = (Message != NULL ? new GameServerMessage(*Message) : NULL);
+  if (Client != NULL)
+    Client->Reactor->Acquire(Client);
+
+  /* Only the first pending command schedules the room */
+  Room->Inbox.Push(Command);
+  if (InterlockedIncrement(&Room->Pending) == 1)
+    Schedule(Room);
+  return true;
+}
+
+void GameServer::ReleaseRetiredClients()
+{
+  vector<GameServerClient*> Retired;
+  if (Lock())
+  {
+    Retired.swap(RetiredClients);
+    Unlock();
+  }
+
+  /* Deleting a client waits for its thread, the sends still pending on the
+     writer drop the last reference otherwise */
+  vector<GameServerClient*>::iterator it;
+  for (it = Retired.begin(); it != Retired.end(); it++)
+  {
+    if ((*it)->Reactor != NULL)
+      (*it)->Reactor->Release(*it);
     else
+      delete *it;
+  }
+}
+
+void GameServer::RemoveRoom(GameServerRoom* Room)
+{
+  /* The relays stop forwarding the room */
+  vector<GameServerClient*>::iterator it;
+  for (it = Room->Relays.begin(); it != Room->Relays.end(); it++)
+  {
+    (*it)->SendNotification(LeftRoom);
+    (*it)->Room = NULL;
+    (*it)->Shard = NULL;
+    (*it)->Relaying = false;
+  }
+  Room->Relays.clear();
+
+  /* Clients joining the upstream room from now on get a new mirror */
+  if (Room->Relay != NULL)
+  {
+    map<unsigned int, unsigned int>::iterator it2 = Mirrors.find(Room->Relay->RoomId);
+    if (it2 != Mirrors.end() && it2->second == Room->Id)
+      Mirrors.erase(it2);
+  }
+
+  PublishRoom(Room, true);
+  IndexRoom(Room, true);
+  IndexName(RoomNameIndex, Room->Id, Room->Name, "");
+  Rooms.Remove(Room->Id);
+}
+
+void GameServer::RemoveRoomObserver(GameServerRoom* Room, GameServerClient* Client)
+{
+  /* Move the last observer in the player's place */
+  unsigned int Index = Client->ObserverIndex;
+  if (Index < Room->Observers.size() && Room->Observers[Index] == Client)
+  {
+    Room->Observers[Index] = Room->Observers.back();
+    Room->Observers[Index]->ObserverIndex = Index;
+    Room->Observers.pop_back();
+  }
+}
+
+void GameServer::StopClock(GameServerRoom* Room)
+{
+  if (Room->ClockRunning)
+  {
+    ChargeClock(Room);
+    Room->ClockRunning = false;
+    EnterCriticalSection(&TimerLock);
+    Timers->Cancel(&Room->FlagTimer);
+    LeaveCriticalSection(&TimerLock);
+  }
+}
+
+void GameServer::SwitchClock(GameServerRoom* Room)
+{
+  /* Send the time left to the player who just moved and start the other clock */
+  if (Room->ClockRunning)
+  {
+    ChargeClock(Room);
+    SendClock(Room, Room->ClockSide);
+    Room->ClockSide ^= 1;
+    ScheduleClock(Room);
+  }
+  else
+    Room->ClockSide ^= 1;
+}
+
+void GameServer::UpdateSnapshot()
+{
+  /* Wake up regularly to notice when the server stops */
+  if (WaitForSingleObject(SnapshotWanted, 100) != WAIT_OBJECT_0)
+    return;
+
+  /* Several readers asking at once get the same snapshot, built without
+     the snapshot lock */
+  GameServerSnapshot* Published = BuildSnapshot();
+  GameServerSnapshot* Replaced = NULL;
+  EnterCriticalSection(&SnapshotLock);
+  if (Published != NULL)
+  {
+    Replaced = Snapshot;
+    Snapshot = Published;
+    if (Replaced != NULL && --Replaced->References > 0)
+      Replaced = NULL;
+  }
+  SnapshotRequested = false;
+  SetEvent(SnapshotPublished);
+  LeaveCriticalSection(&SnapshotLock);
+
+  /* The snapshot replaced is freed here when no reader holds it */
+  if (Replaced != NULL)
+    delete Replaced;
+}
+
+unsigned int GameServer::Run()
+{
+  /* Open a socket for incoming connections, with the largest backlog the system allows */
+  SOCKET Socket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+  if (Socket == INVALID_SOCKET)
+    return 1;
+  sockaddr_in Address;
+  memset(&Address, 0, sizeof(Address));
+  Address.sin_family = AF_INET;
+  Address.sin_port = htons(ListenPort);
+  Address.sin_addr.s_addr = htonl(INADDR_ANY);
+  u_long NonBlocking = 1;
+  if (bind(Socket, (sockaddr*)&Address, sizeof(Address)) == SOCKET_ERROR || listen(Socket, SOMAXCONN) == SOCKET_ERROR || ioctlsocket(Socket, FIONBIO, &NonBlocking) == SOCKET_ERROR)
+  {
+    closesocket(Socket);
+    return 1;
+  }
+
+  while (IsActive())
+  {
+    /* Wait for connection requests, waking up regularly to notice when the server stops */
+    fd_set Readable;
+    FD_ZERO(&Readable);
+    FD_SET(Socket, &Readable);
+    timeval Timeout = {0, 250000};
+    int Result = select(0, &Readable, NULL, NULL, &Timeout);
+    if (Result == SOCKET_ERROR)
+      break;
+    DeleteClosedMirrors();
+    ReleaseRetiredClients();
+    if (Result == 0)
+      continue;
+
+    /* Accept every pending connection request before waiting again */
+    LONG Batch = 0;
+    SOCKET SocketId;
+    while (IsActive() && (SocketId = accept(Socket, NULL, NULL)) != INVALID_SOCKET)
     {
-      int Error = WSAGetLastError();
-      if (Error != WSAEWOULDBLOCK)
-        break;
+      AcceptClient(SocketId);
+      Batch++;
     }
-    Sleep(100);
+    InterlockedExchangeAdd(&AcceptedConnections, Batch);
+    if (Batch > MaxAcceptBatch)
+      MaxAcceptBatch = Batch;
+
+    /* Connections reset while waiting in the backlog are simply skipped */
+    int Error = WSAGetLastError();
+    if (IsActive() && Error != WSAEWOULDBLOCK && Error != WSAECONNRESET)
+      break;
   }
 
   /* Close the server socket */
-  Socket->Close();
+  closesocket(Socket);
 
-  /* Clean up */
-  delete Socket;
+  return 0;
+}
 
+// GameServerTimerThread -------------------------------------------------------
+
+GameServerTimerThread::GameServerTimerThread(GameServer* Parent)
+{
+  Server = Parent;
+  Resume();
+}
+
+unsigned int GameServerTimerThread::Run()
+{
+  while (IsActive())
+  {
+    Sleep(GameServer::TickDuration);
+    Server->ProcessTimers();
+  }
+  return 0;
+}
+
+// GameServerSnapshotThread ----------------------------------------------------
+
+GameServerSnapshotThread::GameServerSnapshotThread(GameServer* Parent)
+{
+  Server = Parent;
+  Resume();
+}
+
+unsigned int GameServerSnapshotThread::Run()
+{
+  while (IsActive())
+    Server->UpdateSnapshot();
   return 0;
 }
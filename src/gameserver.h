@@ -20,21 +20,40 @@
 #ifndef GAMESERVER_H_
 #define GAMESERVER_H_
 
+#include "chessboard.h"
 #include "gameserverdata.h"
 #include "gameserverclient.h"
+#include "gameservercommand.h"
+#include "gameserverevent.h"
+#include "gameservermessage.h"
+#include "gameserverrankindex.h"
+#include "gameserverreactor.h"
+#include "gameserverrelay.h"
+#include "gameserverslotmap.h"
 #include "system.h"
+#include "timingwheel.h"
+#include <algorithm>
+#include <ctype.h>
 #include <limits.h>
 #include <list>
+#include <map>
 #include <observer.h>
+#include <set>
 #include <string>
-#include <tcpserversocket.h>
 #include <thread.h>
+#include <vector>
+#include <zlib.h>
 
 using namespace std;
 
+class GameServer;
 class GameServerClient; /* because of circular reference */
+class GameServerReactor;
+class GameServerSnapshotThread;
+class GameServerTimerThread;
 
 enum GameServerRoomEvent {RoomGameStarted, RoomGameEnded};
+enum GameServerTimerType {ClockTimer, ClientTimer};
 
 struct GameServerRoom
 {
@@ -44,10 +63,39 @@ struct GameServerRoom
   bool Started;
   unsigned int StartTimestamp;
   string Name;
-  GameServerClient* Owner;
+  GameServerReactor* Shard;
+  unsigned int Owner;
   GameServerClient* WhitePlayer;
   GameServerClient* BlackPlayer;
-  list<GameServerClient*> Observers;
+  vector<GameServerClient*> Observers;
+  vector<GameServerClient*> Relays;  /* Relay servers' connections, not members */
+  CRITICAL_SECTION Lock;
+  ChessBoard* Board;  /* Move validation only */
+  GameServerRelay* Relay;  /* Relay servers only, the mirrored room's upstream connection */
+  unsigned int Filters;    /* Those the room matched when last indexed */
+  bool Indexed;
+
+  /* Last game data sent by the owner and the moves, promotions and takebacks
+     made since, served to the players that join */
+  GameServerMessage GameData;
+  bool GameDataCached;
+  vector<GameServerMessage> Journal;
+  unsigned int Revision;         /* Changes whenever the game state does */
+  unsigned int RequestRevision;  /* Revision when the owner was last asked */
+
+  /* Server owned clocks only, in milliseconds, white then black */
+  unsigned long Clocks[2];
+  unsigned int ClockSide;
+  bool ClockRunning;
+  DWORD ClockTimestamp;
+  TimingWheelTimer FlagTimer;
+
+  /* Room actors only */
+  GameServer* Server;
+  GameServerCommandQueue Inbox;
+  volatile LONG Pending;
+  DWORD Runner;
+  GameServerEvent PendingRun;
 };
 
 /* Web interface only */
@@ -63,6 +111,34 @@ struct GameServerClientInfo
   long ConnectionTime;
 };
 
+/* Web interface only */
+struct GameServerMetrics
+{
+  unsigned int Clients;
+  unsigned int Rooms;
+  unsigned long QueuedMessages;
+  unsigned long QueuedBytes;
+  unsigned long MaxQueuedBytes;
+  unsigned long QueueOverflows;
+  unsigned long DroppedMessages;   /* Chat not sent to congested observers */
+  unsigned long CoalescedMessages; /* Queued times and room states replaced by newer ones */
+  unsigned long GameDataHits;      /* Joins served from the cache */
+  unsigned long GameDataRequests;  /* Joins that asked the owner */
+  unsigned long RejectedMoves;
+  unsigned long ReclaimedSessions; /* Connections closed by a deadline */
+  unsigned long AcceptedConnections;
+  unsigned long MaxAcceptBatch;    /* Most connections found in the backlog at once */
+  unsigned long LobbySnapshots;    /* Room lists encoded again after a change */
+  unsigned long CompressedBlobs;
+  unsigned long CompressionRatio;  /* Compressed size in percent of the original one */
+  unsigned long CompressionCost;   /* Per blob, in microseconds */
+  unsigned long SentMessages[GameServerMessage::TypeCount]; /* By message type */
+  unsigned long SendCalls[GameServerMessage::TypeCount];    /* Send calls that included each type */
+  unsigned long LockCount;
+  unsigned long LockTime;     /* In milliseconds */
+  unsigned long MaxLockTime;  /* In microseconds */
+};
+
 /* Web interface only */
 struct GameServerRoomInfo
 {
@@ -75,45 +151,266 @@ struct GameServerRoomInfo
   unsigned int Time;
 };
 
+/* Web interface only, never modified once published */
+struct GameServerSnapshot
+{
+  vector<GameServerClientInfo> Clients;
+  vector<GameServerRoomInfo> Rooms;
+  unsigned long LockCount;  /* Lobby lock statistics, as GameServerMetrics */
+  unsigned long LockTime;
+  unsigned long MaxLockTime;
+  DWORD Timestamp;
+  LONG References; /* Guarded by the server's snapshot lock */
+};
+
 class GameServer : public Thread, public Observable
 {
 public:
   static const int Port;
   static const char* Id;
+  static const int CompactVersion; /* First version using the compact protocol */
+  static const int CompressionVersion; /* First version supporting compressed game data */
   static const int SupportedVersion;
   static const int Version;
 
-  GameServer();
+  GameServer(unsigned int ReactorCount = 0, unsigned int ReactorThreads = 0, bool RoomActors = false, bool ValidateMoves = false, bool ServerClocks = false, const string& UpstreamAddress = "", int ServerPort = 0, const string& RelayAddresses = "");
   ~GameServer();
 
+  GameServerSnapshot* AcquireSnapshot();
   void ChangeSeat(GameServerClient* Client, PlayerType Type);
-  GameServerRoom* CreateRoom(GameServerClient* Client, string Name);
+  unsigned int CreateRoom(GameServerClient* Client, string Name);
   void EndGame(GameServerRoom* Room);
-  GameServerClient* FindPlayer(unsigned int Id);
   GameServerRoom* FindRoom(unsigned int Id);
-  list<GameServerClientInfo*>* GetClients();
-  list<GameServerRoomInfo*>* GetRooms();
-  void JoinRoom(GameServerClient* Client, GameServerRoom* Room);
+  GameServerMetrics GetMetrics();
+  void JoinRoom(GameServerClient* Client, unsigned int RoomId);
   void LeaveRoom(GameServerClient* Client);
+  void QueryNames(GameServerClient* Client, NameQueryType Type, const string& Prefix, unsigned long Limit);
+  void QueryRooms(GameServerClient* Client, unsigned int Filters, unsigned long Offset, unsigned long Limit);
+  void RelayRoom(GameServerClient* Client, unsigned int RoomId);
+  void ReleaseSnapshot(GameServerSnapshot* Snapshot);
   void RemoveClient(GameServerClient* Client);
+  void RemovePlayer(GameServerClient* Client, unsigned int Id);
+  void RetireClient(GameServerClient* Client);
+  void SearchNames(NameQueryType Type, const string& Prefix, unsigned long Limit, vector<pair<unsigned int, string> >& Results);
+  static void SearchSnapshot(GameServerSnapshot* Source, NameQueryType Type, const string& Prefix, unsigned long Limit, vector<pair<unsigned int, string> >& Results);
   void SendGameData(GameServerClient* Client, unsigned char* Data, unsigned long DataSize);
   void SendMessage(GameServerClient* Client, char* Message);
-  void SendMove(GameServerRoom* Room, unsigned long Data);
+  void SendMove(GameServerClient* Client, unsigned long Data);
   void SendNotification(GameServerRoom* Room, NotificationType Notification);
+  void SendPlayerNotification(GameServerClient* Client, NotificationType Notification);
   void SendPromotion(GameServerRoom* Room, int Type);
   void SendRequest(GameServerClient* Client, PlayerRequestType Request);
   void SendRoomList(GameServerClient* Client);
-  void SendTime(GameServerRoom* Room, unsigned int Id, unsigned long Time);
+  void SendTime(GameServerClient* Client, unsigned long Time);
   void SetName(GameServerClient* Client, char* PlayerName);
   void SetReady(GameServerClient* Client);
+  void SubscribeLobby(GameServerClient* Client, bool Subscribe);
 
 private:
-  list<GameServerClient*> Clients;
-  unsigned int ClientIdCounter;
-  list<GameServerRoom*> Rooms;
-  unsigned int RoomIdCounter;
+  /* The lobby lock guards the client and room lists, each room's lock guards
+     its seats, observers and game state. When both are needed the lobby lock
+     is taken first (JoinRoom, LeaveRoom, SetName and the listings), in-game
+     messages and ChangeSeat only take the room's lock. */
+  GameServerSlotMap<GameServerClient*> Clients;  /* By id */
+  GameServerSlotMap<GameServerRoom*> Rooms;      /* By id */
+
+  CRITICAL_SECTION LobbyLock;
+
+  /* Clients subscribed to the lobby get the room list once, then each room's
+     new state as it changes and its removal, instead of polling the list.
+     Changes are published with the room's lock held, the subscribers are
+     guarded by their own lock which is taken last. */
+  CRITICAL_SECTION FeedLock;
+  vector<GameServerClient*> Subscribers;
+
+  /* The room list is sent from a snapshot of every room's info, encoded in a
+     single message. It is versioned by the changes published to the
+     subscribers and rebuilt by the first request following a change. The
+     snapshot is guarded by the lobby lock. */
+  volatile LONG LobbyRevision;
+  LONG SnapshotRevision;
+  GameServerMessage LobbySnapshot;
+  unsigned long LobbySnapshots; /* Times rebuilt */
+
+  /* Room queries are answered from sets of room slots by the filters the
+     rooms match, each room being in the set of every combination of its
+     filters. The sets find a room by its rank, so that a query only looks
+     up the rooms of the page it returns whatever its offset. The sets are
+     updated with the room's lock held and are guarded by their own lock. */
+  static const unsigned int IndexCount = 8;  /* Combinations of the filters */
+  static const unsigned long MaxQueryLimit = 100;
+  CRITICAL_SECTION IndexLock;
+  GameServerRankIndex RoomIndexes[IndexCount];
+  vector<unsigned int> IndexedRooms;  /* Id of the room last indexed in each slot */
+
+  /* The names are indexed case folded, followed by the room's or client's
+     id, so that the names starting with a prefix follow each other. They
+     share the lock of the room indexes. */
+  set<pair<string, unsigned int> > RoomNameIndex;
+  set<pair<string, unsigned int> > PlayerNameIndex;
+
+  volatile LONG GameDataHits;
+  volatile LONG GameDataRequests;
+  volatile LONG RejectedMoves;
+  volatile LONG ReclaimedSessions;
+  volatile LONG AcceptedConnections;
+  volatile LONG MaxAcceptBatch;
+  volatile LONG CompressedBlobs;
+  volatile LONGLONG CompressionInput;  /* In bytes */
+  volatile LONGLONG CompressionOutput; /* In bytes */
+  volatile LONGLONG CompressionTime;   /* In microseconds */
+  unsigned long LockCount;
+  unsigned int LockDepth;
+  LONGLONG LockTime;
+  LARGE_INTEGER LockTimestamp;
+  LONGLONG MaxLockTime;
+  LARGE_INTEGER TimerFrequency;
+
+  vector<GameServerReactor*> Reactors;
+  unsigned int NextReactor;
+  GameServerReactor* Writer;
+
+  /* When rooms are actors the players post their in-game commands to the
+     room's inbox instead of waiting for its lock, the room then runs them in
+     batches on its shard, or on the scheduler when players have threads */
+  static const LONG MaxRoomBatch = 64;
+  static const unsigned int MaxJournalSize = 512;
+
+  /* The game data is compressed once when it is received, the compressed
+     copy is sent to the clients supporting it. Small blobs aren't worth it. */
+  static const unsigned long MinCompressedSize = 256;
+
+  /* Moves are checked against each room's position when validating. The
+     moves are assumed to be encoded as the origin square in the lowest byte
+     and the destination square in the next one, squares numbered from 0 for
+     a1 to 63 for h8, and the promotions to use ChessBoard's piece types. */
+  bool ValidateMoves;
+
+  /* With server owned clocks the times the players send before the game
+     starts, assumed to be in milliseconds, set their clocks. The server then
+     runs the clocks, sends the times after each move and ends the game when
+     a flag falls, which is detected on a timing wheel. */
+  static const unsigned long TickDuration = 10; /* In milliseconds */
+  bool ServerClocks;
+
+  /* Each connection has one deadline on the wheel, for its version exchange
+     and then for its inactivity. The players' activity is only timestamped,
+     an idle deadline that finds recent activity is pushed back. Only the
+     clients idle in the lobby are closed, those in a room or subscribed to
+     the lobby may legitimately stay silent. Dead peers that never send
+     anything are found by TCP keep-alives. */
+  static const unsigned long HandshakeTimeout = 10000; /* In milliseconds */
+  static const unsigned long IdleTimeout = 1800000;    /* In milliseconds */
+  CRITICAL_SECTION TimerLock;
+  TimingWheel* Timers;
+  DWORD TimerTimestamp;
+  GameServerTimerThread* TimerThread;
 
-  HANDLE Mutex;
+  /* The web interface reads the clients, rooms, names and lobby counts from
+     a snapshot, built by its own thread when asked and at most once per
+     period, so that the web server's thread never takes the game's locks.
+     A reader gets the current snapshot at once, only the first one is
+     waited for, and a stale one is rebuilt for the next readers. The current
+     snapshot and each reader hold a reference, counted under a lock only
+     held to swap or count them, and a snapshot is freed with its last
+     reference. */
+  static const DWORD SnapshotPeriod = 1000; /* In milliseconds */
+  CRITICAL_SECTION SnapshotLock;
+  GameServerSnapshot* Snapshot;
+  bool SnapshotRequested;
+  HANDLE SnapshotWanted;    /* Wakes up the snapshot thread */
+  HANDLE SnapshotPublished; /* Wakes up the readers waiting for a snapshot */
+  GameServerSnapshotThread* SnapshotThread;
+  bool RoomActors;
+  GameServerReactor* Scheduler;
+
+  /* A relay server only has observers, in mirrors of the upstream server's
+     rooms. Its clients join the rooms by their upstream ids, its clients'
+     ids are tagged so that they never collide with the upstream ones. */
+  string Upstream;
+  static const unsigned int MaxMirrors = 256;
+  map<unsigned int, unsigned int> Mirrors;  /* Local room id by upstream id */
+  vector<GameServerRoom*> ClosedMirrors;    /* Torn down, waiting to be deleted */
+
+  /* A relay gets every room's traffic, private ones included, only the
+     relay servers configured by their addresses may ask for it */
+  vector<unsigned long> RelayPeers;
+
+  /* A client with its own thread can't be deleted by it, the listening
+     thread drops its last reference once the thread is done with it */
+  vector<GameServerClient*> RetiredClients;
+  int ListenPort;
+
+  void AcceptClient(SOCKET SocketId);
+  void AddRoomObserver(GameServerRoom* Room, GameServerClient* Client);
+  GameServerSnapshot* BuildSnapshot();
+  void ChargeClock(GameServerRoom* Room);
+  void CheckClock(unsigned int RoomId);
+  void CheckClient(unsigned int ClientId);
+  void CloseMirror(GameServerRoom* Room);
+  void CompressGameData(GameServerMessage& Message, const unsigned char* Data, unsigned long DataSize);
+  void DeleteClosedMirrors();
+  void DeleteRoom(GameServerRoom* Room);
+  void ReleaseRetiredClients();
+  void ForwardGameData(GameServerClient* Client, const GameServerMessage& Message);
+  GameServerMessage GetRoomInfo(GameServerRoom* Room);
+  void IndexName(set<pair<string, unsigned int> >& Index, unsigned int Id, const string& Before, const string& After);
+  void IndexRoom(GameServerRoom* Room, bool Removed = false);
+  void InvalidateGameData(GameServerRoom* Room);
+  void JournalGameData(GameServerRoom* Room, const GameServerMessage& Message);
+  bool Lock(DWORD Timeout = INFINITE);
+  GameServerRoom* LockRoom(GameServerClient* Client);
+  bool LockRoom(GameServerRoom* Room);
+  unsigned int MirrorRoom(GameServerClient* Client, unsigned int UpstreamId);
+  GameServerRoom* NewRoom(GameServerClient* Client, string Name);
+  void Unlock();
+  void UnlockRoom(GameServerRoom* Room);
+  void ProcessTimers();
+  void PublishRoom(GameServerRoom* Room, bool Removed = false);
+  void ResumeClock(GameServerRoom* Room);
+  bool Post(GameServerRoom* Room, GameServerCommandType Type, GameServerClient* Client = NULL, unsigned long Value = 0, unsigned long Time = 0, const string& Data = "", const GameServerMessage* Message = NULL);
+  void RemoveRoom(GameServerRoom* Room);
+  void RemoveRoomObserver(GameServerRoom* Room, GameServerClient* Client);
+  unsigned int Run();
+  void RunRoom(GameServerRoom* Room);
+  void Schedule(GameServerRoom* Room);
+  void ScheduleClient(GameServerClient* Client, unsigned long Timeout);
+  void ScheduleClock(GameServerRoom* Room);
+  void SendClock(GameServerRoom* Room, unsigned int Side);
+  void SendRoomState(GameServerRoom* Room, GameServerClient* Client);
+  void SendToRoom(GameServerRoom* Room, const GameServerMessage& Message, unsigned int ExceptId = 0);
+  void StopClock(GameServerRoom* Room);
+  void SwitchClock(GameServerRoom* Room);
+  void UpdateSnapshot();
+
+  static string FoldName(const string& Name);
+
+  friend class GameServerReactorThread;
+  friend class GameServerRelay;
+  friend class GameServerSnapshotThread;
+  friend class GameServerTimerThread;
+};
+
+/* Thread that builds the web interface's snapshots */
+class GameServerSnapshotThread : public Thread
+{
+public:
+  GameServerSnapshotThread(GameServer* Parent);
+
+private:
+  GameServer* Server;
+
+  unsigned int Run();
+};
+
+/* Thread that advances the server's timing wheel */
+class GameServerTimerThread : public Thread
+{
+public:
+  GameServerTimerThread(GameServer* Parent);
+
+private:
+  GameServer* Server;
 
   unsigned int Run();
 };
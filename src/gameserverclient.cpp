@@ -22,24 +22,90 @@
 #include <iostream>
 #endif
 
+/* Initialise static class members */
+const unsigned long GameServerClient::MaxBufferSize = 1048576;
+volatile LONG GameServerClient::QueuedMessages = 0;
+volatile LONG GameServerClient::QueuedBytes = 0;
+volatile LONG GameServerClient::MaxQueuedBytes = 0;
+volatile LONG GameServerClient::Overflows = 0;
+volatile LONG GameServerClient::DroppedMessages = 0;
+volatile LONG GameServerClient::CoalescedMessages = 0;
+volatile LONG GameServerClient::SentMessages[GameServerMessage::TypeCount];
+volatile LONG GameServerClient::SendCalls[GameServerMessage::TypeCount];
+
 // Public functions ------------------------------------------------------------
 
 GameServerClient::GameServerClient(GameServer* Parent, SOCKET SocketId, unsigned int ClientId)
 {
   Id = ClientId;
   Name = "";
+  ObserverIndex = 0;
   Ready = false;
+  Relaying = false;
+  Shard = NULL;
+  Subscribed = false;
   Room = NULL;
   Server = Parent;
   Socket = new TCPClientSocket(SocketId);
+  SocketHandle = SocketId;
+  ClientThread = NULL;
+  Closed = false;
+  Connected = false;
+  References = 0;
   Synchronised = false;
   Version = 0;
-  Resume();
+  Compact = false;
+  Compression = false;
+  Framed = false;
+  FramePosition = 0;
+  LastActivity = GetTickCount();
+  TimingWheel::Initialise(&Deadline);
+  Buffered = false;
+  Incomplete = false;
+  InPosition = 0;
+  Reactor = NULL;
+  InitializeCriticalSection(&QueueLock);
+  OutQueueOffset = 0;
+  OutQueueSize = 0;
+  OutQueueInFlight = 0;
+  Sending = false;
+  Stalled = false;
+  StallTimestamp = 0;
+
+  /* Let the system probe peers that went away without closing the connection */
+  BOOL KeepAlive = TRUE;
+  setsockopt(SocketId, SOL_SOCKET, SO_KEEPALIVE, (const char*)&KeepAlive, sizeof(KeepAlive));
+  tcp_keepalive Settings;
+  Settings.onoff = 1;
+  Settings.keepalivetime = 60000;
+  Settings.keepaliveinterval = 5000;
+  DWORD Size;
+  WSAIoctl(SocketId, SIO_KEEPALIVE_VALS, &Settings, sizeof(Settings), NULL, 0, &Size, NULL, NULL);
 }
 
 GameServerClient::~GameServerClient()
 {
-  Socket->Close();
+  Close();
+  if (ClientThread != NULL)
+    delete ClientThread;
+  delete Socket;
+
+  /* Discard the data that was never sent */
+  InterlockedExchangeAdd(&QueuedMessages, -(LONG)OutQueue.size());
+  InterlockedExchangeAdd(&QueuedBytes, -(LONG)OutQueueSize);
+  DeleteCriticalSection(&QueueLock);
+}
+
+void GameServerClient::Close()
+{
+  /* The socket is closed under the queue's lock so that no send is started on a closed socket */
+  EnterCriticalSection(&QueueLock);
+  if (!Closed)
+  {
+    Closed = true;
+    Socket->Close();
+  }
+  LeaveCriticalSection(&QueueLock);
 }
 
 long GameServerClient::ConnectionTime()
@@ -47,166 +113,253 @@ long GameServerClient::ConnectionTime()
   return Socket->GetConnectionTime();
 }
 
-bool GameServerClient::SendGameData(const void* Data, const unsigned long DataSize)
+void GameServerClient::Disconnect()
 {
-  if (!Socket->SendInteger(ND_GameData))
-    return false;
-  if (!Socket->SendInteger(DataSize))
+  /* Remove the player from the server */
+  if (Connected)
+    Server->LeaveRoom(this);
+  Server->RemoveClient(this);
+
+  /* Close the socket */
+  Close();
+}
+
+unsigned long GameServerClient::GetAddress()
+{
+  /* The peer's IPv4 address, in network order */
+  sockaddr_in Address;
+  int AddressSize = sizeof(Address);
+  if (getpeername(SocketHandle, (sockaddr*)&Address, &AddressSize) == SOCKET_ERROR || Address.sin_family != AF_INET)
+    return INADDR_NONE;
+  return Address.sin_addr.s_addr;
+}
+
+bool GameServerClient::IsConnected()
+{
+  return Connected;
+}
+
+bool GameServerClient::ReceiveBuffer(const char* Data, const unsigned long DataSize)
+{
+  InBuffer.append(Data, DataSize);
+  if (InBuffer.size() > MaxBufferSize)
     return false;
-  if (!Socket->SendBytes(Data, DataSize))
+
+  /* Process every complete message in the buffer */
+  int Result = 1;
+  while (Result > 0 && InPosition < InBuffer.size())
+  {
+    unsigned long Position = InPosition;
+    Incomplete = false;
+    if (Connected)
+      Result = ReceiveData(this);
+    else
+      Result = ReceiveVersion(this);
+    if (Incomplete)
+    {
+      /* Wait for the rest of the message */
+      InPosition = Position;
+      Result = 1;
+      break;
+    }
+  }
+  InBuffer.erase(0, InPosition);
+  InPosition = 0;
+  return (Result > 0);
+}
+
+bool GameServerClient::Send(const GameServerMessage& Message)
+{
+  const string& Data = Encode(Message);
+  bool Flush = false;
+  bool Overflow = false;
+
+  /* The players of a game get more leeway than its observers, relays included */
+  GameServerRoom* CurrentRoom = Room;
+  bool Seated = (!Relaying && CurrentRoom != NULL && (CurrentRoom->WhitePlayer == this || CurrentRoom->BlackPlayer == this));
+
+  EnterCriticalSection(&QueueLock);
+  if (!Closed && Reactor != NULL)
+  {
+    CongestionAction Action = GameServerCongestion::Admit(Message.GetType(), Seated, OutQueueSize, Data.size(), Stalled, GetTickCount() - StallTimestamp);
+    if (Action == CoalesceMessage && !Coalesce(Message))
+      Action = GameServerCongestion::Admit(Message.GetType(), Seated, OutQueueSize, Data.size(), Stalled, GetTickCount() - StallTimestamp, false);
+    if (Action == DropMessage)
+      InterlockedIncrement(&DroppedMessages);
+    else if (Action == CoalesceMessage)
+      InterlockedIncrement(&CoalescedMessages);
+    else if (Action == CloseClient)
+      Overflow = true;
+    else
+    {
+      /* Queue the data, the reactor sends it once the caller released its locks */
+      OutQueue.push_back(Message);
+      OutQueueSize += Data.size();
+      InterlockedIncrement(&QueuedMessages);
+      InterlockedExchangeAdd(&QueuedBytes, Data.size());
+      LONG Max = MaxQueuedBytes;
+      while ((LONG)OutQueueSize > Max && InterlockedCompareExchange(&MaxQueuedBytes, OutQueueSize, Max) != Max)
+        Max = MaxQueuedBytes;
+      if (GameServerCongestion::Stalls(OutQueueSize) && !Stalled)
+      {
+        /* Only a player gets here, the grace period starts */
+        Stalled = true;
+        StallTimestamp = GetTickCount();
+      }
+      if (!Sending)
+      {
+        Sending = true;
+        Flush = true;
+      }
+    }
+  }
+  LeaveCriticalSection(&QueueLock);
+
+  if (Overflow)
+  {
+    /* The client is not reading its data, drop the connection */
+    InterlockedIncrement(&Overflows);
+    Close();
     return false;
-  return true;
+  }
+  if (Flush)
+    Reactor->Flush(this);
+  return !Closed;
+}
+
+bool GameServerClient::SendGameData(const void* Data, const unsigned long DataSize)
+{
+  GameServerMessage Message(ND_GameData);
+  Message.AddInteger(DataSize);
+  Message.AddBytes(Data, DataSize);
+  return Send(Message);
 }
 
 bool GameServerClient::SendHostChanged(const unsigned int Id)
 {
-  if (!Socket->SendInteger(ND_HostChanged))
-    return false;
-  if (!Socket->SendInteger(Id))
-    return false;
-  return true;
+  GameServerMessage Message(ND_HostChanged);
+  Message.AddInteger(Id);
+  return Send(Message);
 }
 
-bool GameServerClient::SendMessage(const unsigned int PlayerId, const string Message)
+bool GameServerClient::SendMessage(const unsigned int PlayerId, const string Text)
 {
-  if (!Socket->SendInteger(ND_Message))
-    return false;
-  if (!Socket->SendInteger(PlayerId))
-    return false;
-  if (!Socket->SendString(Message.c_str()))
-    return false;
-  return true;
+  GameServerMessage Message(ND_Message);
+  Message.AddInteger(PlayerId);
+  Message.AddString(Text);
+  return Send(Message);
 }
 
 bool GameServerClient::SendMove(const unsigned long Data)
 {
-  if (!Socket->SendInteger(ND_Move))
-    return false;
-  if (!Socket->SendInteger(Data))
-    return false;
-  return true;
+  GameServerMessage Message(ND_Move);
+  Message.AddInteger(Data);
+  return Send(Message);
 }
 
 bool GameServerClient::SendName(const unsigned int PlayerId, const string PlayerName)
 {
-  if (!Socket->SendInteger(ND_Name))
-    return false;
-  if (!Socket->SendInteger(PlayerId))
-    return false;
-  if (!Socket->SendString(PlayerName.c_str()))
-    return false;
-  return true;
+  GameServerMessage Message(ND_Name);
+  Message.AddInteger(PlayerId);
+  Message.AddString(PlayerName);
+  return Send(Message);
 }
 
 bool GameServerClient::SendNetworkRequest(const NetworkRequestType Request)
 {
-  if (!Socket->SendInteger(ND_NetworkRequest))
-    return false;
-  if (!Socket->SendInteger(Request))
-    return false;
-  return true;
+  GameServerMessage Message(ND_NetworkRequest);
+  Message.AddInteger(Request);
+  return Send(Message);
 }
 
 bool GameServerClient::SendNotification(const NotificationType Notification)
 {
-  if (!Socket->SendInteger(ND_Notification))
-    return false;
-  if (!Socket->SendInteger(Notification))
-    return false;
-  return true;
+  GameServerMessage Message(ND_Notification);
+  Message.AddInteger(Notification);
+  return Send(Message);
 }
 
 bool GameServerClient::SendPlayerId(const unsigned int Id)
 {
-  if (!Socket->SendInteger(ND_PlayerId))
-    return false;
-  if (!Socket->SendInteger(Id))
-    return false;
-  return true;
+  GameServerMessage Message(ND_PlayerId);
+  Message.AddInteger(Id);
+  return Send(Message);
 }
 
 bool GameServerClient::SendPlayerType(const unsigned int PlayerId, const PlayerType Type)
 {
-  if (!Socket->SendInteger(ND_PlayerType))
-    return false;
-  if (!Socket->SendInteger(PlayerId))
-    return false;
-  if (!Socket->SendInteger(Type))
-    return false;
-  return true;
+  GameServerMessage Message(ND_PlayerType);
+  Message.AddInteger(PlayerId);
+  Message.AddInteger(Type);
+  return Send(Message);
 }
 
 bool GameServerClient::SendPlayerJoined(const unsigned int PlayerId, const string PlayerName)
 {
-  if (!Socket->SendInteger(ND_PlayerJoined))
-    return false;
-  if (!Socket->SendInteger(PlayerId))
-    return false;
-  if (!Socket->SendString(PlayerName.c_str()))
-    return false;
-  return true;
+  GameServerMessage Message(ND_PlayerJoined);
+  Message.AddInteger(PlayerId);
+  Message.AddString(PlayerName);
+  return Send(Message);
 }
 
 bool GameServerClient::SendPlayerLeft(const unsigned int PlayerId)
 {
-  if (!Socket->SendInteger(ND_PlayerLeft))
-    return false;
-  if (!Socket->SendInteger(PlayerId))
-    return false;
-  return true;
+  GameServerMessage Message(ND_PlayerLeft);
+  Message.AddInteger(PlayerId);
+  return Send(Message);
 }
 
 bool GameServerClient::SendPlayerReady(const unsigned int PlayerId)
 {
-  if (!Socket->SendInteger(ND_PlayerReady))
-    return false;
-  if (!Socket->SendInteger(PlayerId))
-    return false;
-  return true;
+  GameServerMessage Message(ND_PlayerReady);
+  Message.AddInteger(PlayerId);
+  return Send(Message);
 }
 
 bool GameServerClient::SendPlayerRequest(const PlayerRequestType Request)
 {
-  if (!Socket->SendInteger(ND_PlayerRequest))
-    return false;
-  if (!Socket->SendInteger(Request))
-    return false;
-  return true;
+  GameServerMessage Message(ND_PlayerRequest);
+  Message.AddInteger(Request);
+  return Send(Message);
 }
 
 bool GameServerClient::SendPromoteTo(const int Type)
 {
-  if (!Socket->SendInteger(ND_PromoteTo))
-    return false;
-  if (!Socket->SendInteger(Type))
-    return false;
-  return true;
+  GameServerMessage Message(ND_PromoteTo);
+  Message.AddInteger(Type);
+  return Send(Message);
 }
 
 bool GameServerClient::SendRoomInfo(const unsigned int RoomId, const string RoomName, const bool RoomPrivate, const int PlayerCount)
 {
-  if (!Socket->SendInteger(ND_RoomInfo))
-    return false;
-  if (!Socket->SendInteger(RoomId))
-    return false;
-  if (!Socket->SendString(RoomName.c_str()))
-    return false;
-  if (!Socket->SendInteger(RoomPrivate))
-    return false;
-  if (!Socket->SendInteger(PlayerCount))
-    return false;
-  return true;
+  GameServerMessage Message(ND_RoomInfo);
+  Message.AddInteger(RoomId);
+  Message.AddString(RoomName);
+  Message.AddInteger(RoomPrivate);
+  Message.AddInteger(PlayerCount);
+  return Send(Message);
 }
 
 bool GameServerClient::SendTime(const unsigned int PlayerId, const unsigned long Time)
 {
-  if (!Socket->SendInteger(ND_PlayerTime))
-    return false;
-  if (!Socket->SendInteger(PlayerId))
-    return false;
-  if (!Socket->SendInteger(Time))
-    return false;
-  return true;
+  GameServerMessage Message(ND_PlayerTime);
+  Message.AddInteger(PlayerId);
+  Message.AddInteger(Time);
+  return Send(Message);
+}
+
+bool GameServerClient::SendVersion()
+{
+  GameServerMessage Message;
+  Message.AddString(GameServer::Id);
+  Message.AddInteger(GameServer::Version);
+  return Send(Message);
+}
+
+void GameServerClient::Start()
+{
+  /* Read from the socket on a dedicated thread */
+  ClientThread = new GameServerClientThread(this);
 }
 
 // Private static functions ----------------------------------------------------
@@ -215,7 +368,13 @@ int GameServerClient::ReceiveData(GameServerClient* Client)
 {
   if (Client != NULL)
   {
-    long DataType = Client->Socket->ReceiveInteger();
+    /* A compact message is read as a whole frame first */
+    Client->Framed = false;
+    if (Client->Compact && !Client->ReceiveFrame())
+      return 0;
+
+    long DataType = Client->ReceiveInteger();
+    Client->LastActivity = GetTickCount();
     switch (DataType)
     {
       case -1:
@@ -224,7 +383,7 @@ int GameServerClient::ReceiveData(GameServerClient* Client)
       }
       case ND_CreateRoom:
       {
-        char* RoomName = Client->Socket->ReceiveString();
+        char* RoomName = Client->ReceiveString();
         if (RoomName == NULL)
           return 0;
   #ifdef DEBUG
@@ -238,7 +397,7 @@ int GameServerClient::ReceiveData(GameServerClient* Client)
       }
       case ND_JoinRoom:
       {
-        long RoomId = Client->Socket->ReceiveInteger();
+        long RoomId = Client->ReceiveInteger();
         if (RoomId == -1)
           return 0;
   #ifdef DEBUG
@@ -246,7 +405,7 @@ int GameServerClient::ReceiveData(GameServerClient* Client)
         std::cout << "Received a request from player " << Client->Id << " to join the room " << RoomId << std::endl;
   #endif
         Client->Server->LeaveRoom(Client);
-        Client->Server->JoinRoom(Client, Client->Server->FindRoom(RoomId));
+        Client->Server->JoinRoom(Client, RoomId);
         break;
       }
       case ND_LeaveRoom:
@@ -260,20 +419,19 @@ int GameServerClient::ReceiveData(GameServerClient* Client)
       }
       case ND_RemovePlayer:
       {
-        long PlayerId = Client->Socket->ReceiveInteger();
+        long PlayerId = Client->ReceiveInteger();
         if (PlayerId == -1)
           return 0;
   #ifdef DEBUG
         /* Output to log */
         std::cout << "Received a request from player " << Client->Id << " to kick player " << PlayerId << " from the room" << std::endl;
   #endif
-        if (Client->Room != NULL && Client == Client->Room->Owner)
-          Client->Server->LeaveRoom(Client->Server->FindPlayer(PlayerId));
+        Client->Server->RemovePlayer(Client, PlayerId);
         break;
       }
       case ND_ChangeType:
       {
-        PlayerType Type = (PlayerType)Client->Socket->ReceiveInteger();
+        PlayerType Type = (PlayerType)Client->ReceiveInteger();
         if (Type == -1)
           return 0;
   #ifdef DEBUG
@@ -293,20 +451,20 @@ int GameServerClient::ReceiveData(GameServerClient* Client)
       }
       case ND_GameData:
       {
-        long DataSize = (unsigned long)Client->Socket->ReceiveInteger();
-        if (DataSize == -1)
+        long DataSize = (unsigned long)Client->ReceiveInteger();
+        if (DataSize < 0 || (unsigned long)DataSize > MaxBufferSize)
           return 0;
         unsigned char* Data = new unsigned char[DataSize];
         if (Data == NULL)
           return 0;
-        if (Client->Socket->ReceiveBytes(Data, DataSize) == (unsigned long)DataSize)
+        if (Client->ReceiveBytes(Data, DataSize) == (unsigned long)DataSize)
           Client->Server->SendGameData(Client, Data, DataSize);
         delete[] Data;
         break;
       }
       case ND_Message:
       {
-        char* Message = Client->Socket->ReceiveString();
+        char* Message = Client->ReceiveString();
         if (Message == NULL)
           return 0;
   #ifdef DEBUG
@@ -319,20 +477,19 @@ int GameServerClient::ReceiveData(GameServerClient* Client)
       }
       case ND_Move:
       {
-        long Data = Client->Socket->ReceiveInteger();
+        long Data = Client->ReceiveInteger();
         if (Data == -1)
           return 0;
   #ifdef DEBUG
         /* Output to log */
         std::cout << "Received a move from player " << Client->Id << std::endl;
   #endif
-        if (Client->Room != NULL && (Client == Client->Room->WhitePlayer || Client == Client->Room->BlackPlayer))
-          Client->Server->SendMove(Client->Room, Data);
+        Client->Server->SendMove(Client, Data);
         break;
       }
       case ND_Name:
       {
-        char* PlayerName = Client->Socket->ReceiveString();
+        char* PlayerName = Client->ReceiveString();
         if (PlayerName == NULL)
           return 0;
   #ifdef DEBUG
@@ -345,7 +502,7 @@ int GameServerClient::ReceiveData(GameServerClient* Client)
       }
       case ND_NetworkRequest:
       {
-        NetworkRequestType Request = (NetworkRequestType)Client->Socket->ReceiveInteger();
+        NetworkRequestType Request = (NetworkRequestType)Client->ReceiveInteger();
         if (Request == -1)
           return 0;
         switch (Request)
@@ -355,6 +512,40 @@ int GameServerClient::ReceiveData(GameServerClient* Client)
             Client->Server->SendRoomList(Client);
             break;
           }
+          case SubscribeLobby:
+          case UnsubscribeLobby:
+          {
+            Client->Server->SubscribeLobby(Client, Request == SubscribeLobby);
+            break;
+          }
+          case RoomQuery:
+          {
+            /* Filters, offset and limit of the page */
+            long Filters = Client->ReceiveInteger();
+            long Offset = Client->ReceiveInteger();
+            long Limit = Client->ReceiveInteger();
+            if (Filters == -1 || Offset == -1 || Limit == -1)
+              return 0;
+            Client->Server->QueryRooms(Client, Filters, Offset, Limit);
+            break;
+          }
+          case NameQuery:
+          {
+            /* Names searched, prefix and limit */
+            long Type = Client->ReceiveInteger();
+            char* Prefix = Client->ReceiveString();
+            if (Prefix == NULL)
+              return 0;
+            long Limit = Client->ReceiveInteger();
+            if (Type == -1 || Limit == -1)
+            {
+              delete[] Prefix;
+              return 0;
+            }
+            Client->Server->QueryNames(Client, (NameQueryType)Type, Prefix, Limit);
+            delete[] Prefix;
+            break;
+          }
           default:
             break;
         }
@@ -362,66 +553,20 @@ int GameServerClient::ReceiveData(GameServerClient* Client)
       }
       case ND_Notification:
       {
-        NotificationType Notification = (NotificationType)Client->Socket->ReceiveInteger();
+        NotificationType Notification = (NotificationType)Client->ReceiveInteger();
         if (Notification == -1)
           return 0;
-        GameServerRoom* Room = Client->Room;
-        if (Room != NULL && (Client == Room->WhitePlayer || Client == Room->BlackPlayer))
-        {
-          switch (Notification)
-          {
-            case IAmReady:
-            {
   #ifdef DEBUG
-              /* Output to log */
-              std::cout << "Received a ready notification from player " << Client->Id << std::endl;
+        /* Output to log */
+        if (Notification == IAmReady)
+          std::cout << "Received a ready notification from player " << Client->Id << std::endl;
   #endif
-              Client->Server->SetReady(Client);
-              break;
-            }
-            case IResign:
-            {
-              Client->Server->SendNotification(Room, Resigned);
-              Client->Server->EndGame(Room);
-              break;
-            }
-            case GamePaused:
-            {
-              Room->Paused = true;
-              Client->Server->SendNotification(Room, GamePaused);
-              break;
-            }
-            case GameResumed:
-            {
-              Room->Paused = false;
-              Client->Server->SendNotification(Room, GameResumed);
-              break;
-            }
-            case DrawRequestAccepted:
-            {
-              Client->Server->SendNotification(Room, GameDrawed);
-              Client->Server->EndGame(Room);
-              break;
-            }
-            case TakebackRequestAccepted:
-            {
-              Client->Server->SendNotification(Room, TookbackMove);
-              break;
-            }
-            case GameEnded:
-            {
-              Client->Server->EndGame(Room);
-              break;
-            }
-            default:
-              Client->Server->SendNotification(Room, Notification);
-          }
-        }
+        Client->Server->SendPlayerNotification(Client, Notification);
         break;
       }
       case ND_PlayerRequest:
       {
-        PlayerRequestType Request = (PlayerRequestType)Client->Socket->ReceiveInteger();
+        PlayerRequestType Request = (PlayerRequestType)Client->ReceiveInteger();
         if (Request == -1)
           return 0;
         Client->Server->SendRequest(Client, Request);
@@ -429,20 +574,19 @@ int GameServerClient::ReceiveData(GameServerClient* Client)
       }
       case ND_PlayerTime:
       {
-        long Time = Client->Socket->ReceiveInteger();
+        long Time = Client->ReceiveInteger();
         if (Time == -1)
           return 0;
   #ifdef DEBUG
         /* Output to log */
         std::cout << "Received time from player " << Client->Id << std::endl;
   #endif
-        if (Client->Room != NULL && (Client == Client->Room->WhitePlayer || Client == Client->Room->BlackPlayer))
-          Client->Server->SendTime(Client->Room, Client->Id, Time);
+        Client->Server->SendTime(Client, Time);
         break;
       }
       case ND_PromoteTo:
       {
-        int Type = Client->Socket->ReceiveInteger();
+        int Type = Client->ReceiveInteger();
         if (Type == -1)
           return 0;
   #ifdef DEBUG
@@ -452,43 +596,213 @@ int GameServerClient::ReceiveData(GameServerClient* Client)
         Client->Server->SendPromotion(Client->Room, Type);
         break;
       }
+      case ND_RelayRoom:
+      {
+        long RoomId = Client->ReceiveInteger();
+        if (RoomId == -1)
+          return 0;
+  #ifdef DEBUG
+        /* Output to log */
+        std::cout << "Received a request from relay " << Client->Id << " to forward the room " << RoomId << std::endl;
+  #endif
+        Client->Server->LeaveRoom(Client);
+        Client->Server->RelayRoom(Client, RoomId);
+        break;
+      }
       default:
-        return 0;
+      {
+        /* The compact protocol can skip the messages it doesn't know */
+        if (!Client->Compact)
+          return 0;
+        break;
+      }
     }
     return 1;
   }
   return 0;
 }
 
+int GameServerClient::ReceiveVersion(GameServerClient* Client)
+{
+  if (Client != NULL)
+  {
+    /* Receive the client's version information */
+    char* Str = Client->ReceiveString();
+    if (Str == NULL)
+      return 0;
+    Client->Version = Client->ReceiveInteger();
+
+    /* Validate the version information */
+    bool Valid = (strcmp(GameServer::Id,Str) == 0 && Client->Version >= GameServer::SupportedVersion);
+    delete[] Str;
+    if (Valid)
+    {
+      Client->Connected = true;
+
+      /* Recent clients use the compact protocol from now on */
+      Client->Compact = (Client->Version >= GameServer::CompactVersion);
+      Client->Compression = (Client->Version >= GameServer::CompressionVersion);
+
+      /* Send the new id to the player */
+      Client->SendPlayerId(Client->Id);
+      return 1;
+    }
+  }
+  return 0;
+}
+
 // Private functions -----------------------------------------------------------
 
-unsigned int GameServerClient::Run()
+bool GameServerClient::Coalesce(const GameServerMessage& Message)
 {
-  /* Exchange version information with the client */
-  Socket->SendString(GameServer::Id);
-  Socket->SendInteger(GameServer::Version);
-  char* Str = Socket->ReceiveString();
-  Version = Socket->ReceiveInteger();
+  /* Only a player's latest time and a room's latest state matter, they
+     replace the queued one that isn't being sent yet. Both messages start
+     with the type and the player's or room's id in the fixed width encoding,
+     the compact ones can differ in size. */
+  if (Message.GetType() != ND_PlayerTime && Message.GetType() != ND_RoomInfo)
+    return false;
+  const string& Data = Message.GetData();
+  unsigned long Index = OutQueue.size();
+  list<GameServerMessage>::reverse_iterator it;
+  for (it = OutQueue.rbegin(); it != OutQueue.rend() && Index > OutQueueInFlight; it++, Index--)
+  {
+    if (it->GetType() == Message.GetType() && it->GetData().compare(0, 8, Data, 0, 8) == 0)
+    {
+      LONG Delta = (LONG)Encode(Message).size() - (LONG)Encode(*it).size();
+      OutQueueSize += Delta;
+      InterlockedExchangeAdd(&QueuedBytes, Delta);
+      *it = Message;
+      return true;
+    }
+  }
+  return false;
+}
 
-  /* Validate the version information */
-  if (Str != NULL && strcmp(GameServer::Id,Str) == 0 && Version >= GameServer::SupportedVersion)
+const string& GameServerClient::Encode(const GameServerMessage& Message) const
+{
+  /* The protocol is chosen once the version information was exchanged, the
+     messages without a type sent afterwards are batches of frames */
+  const GameServerMessage& Encoded = (Compression ? Message.GetCompressed() : Message);
+  if (Compact)
+    return Encoded.GetFrame();
+  return Encoded.GetData();
+}
+
+bool GameServerClient::ReceiveFrame()
+{
+  /* Read the frame's length, then the whole frame */
+  unsigned long Length = 0;
+  unsigned char Byte;
+  unsigned int Shift = 0;
+  do
   {
-    /* Send the new id to the player */
-    SendPlayerId(Id);
+    if (Shift > 28 || ReceiveBytes(&Byte, 1) != 1)
+      return false;
+    Length |= (unsigned long)(Byte & 0x7F) << Shift;
+    Shift += 7;
+  } while ((Byte & 0x80) != 0);
+  if (Length > MaxBufferSize)
+    return false;
+  Frame.resize(Length);
+  if (Length > 0 && ReceiveBytes(&Frame[0], Length) != Length)
+    return false;
+  FramePosition = 0;
+  Framed = true;
+  return true;
+}
 
-    while (ReceiveData(this) > 0);
+/* Data buffered by a reactor uses the same encoding as GameServerMessage.
+ * Reading past the end of the buffer flags the message as incomplete so that
+ * it can be parsed again when more data is received. A compact frame is
+ * complete once read, reading past its end is an error. */
 
-    /* Remove the player from the server */
-    Server->LeaveRoom(this);
+long GameServerClient::ReceiveInteger()
+{
+  if (Framed)
+  {
+    unsigned long Value;
+    return (GameServerMessage::ReadVarint(Frame, FramePosition, Value) ? (long)Value : -1);
   }
+  if (!Buffered)
+    return Socket->ReceiveInteger();
 
-  /* Close the socket */
-  Server->RemoveClient(this);
-  Socket->Close();
+  u_long Value;
+  if (ReceiveBytes(&Value, sizeof(Value)) != sizeof(Value))
+    return -1;
+  return (long)ntohl(Value);
+}
 
-  /* Clean up */
-  delete Socket;
-  delete[] Str;
+char* GameServerClient::ReceiveString()
+{
+  if (Framed)
+  {
+    long Length = ReceiveInteger();
+    if (Length < 0 || Frame.size() - FramePosition < (unsigned long)Length)
+      return NULL;
+    char* Str = new char[Length+1];
+    memcpy(Str, Frame.data() + FramePosition, Length);
+    Str[Length] = 0;
+    FramePosition += Length;
+    return Str;
+  }
+  if (!Buffered)
+    return Socket->ReceiveString();
+
+  long Length = ReceiveInteger();
+  if (Length < 0)
+    return NULL;
+  if (InBuffer.size() - InPosition < (unsigned long)Length)
+  {
+    Incomplete = true;
+    return NULL;
+  }
+  char* Str = new char[Length+1];
+  memcpy(Str, InBuffer.data() + InPosition, Length);
+  Str[Length] = 0;
+  InPosition += Length;
+  return Str;
+}
+
+unsigned long GameServerClient::ReceiveBytes(void* Data, const unsigned long DataSize)
+{
+  if (Framed)
+  {
+    if (Frame.size() - FramePosition < DataSize)
+      return 0;
+    memcpy(Data, Frame.data() + FramePosition, DataSize);
+    FramePosition += DataSize;
+    return DataSize;
+  }
+  if (!Buffered)
+    return Socket->ReceiveBytes(Data, DataSize);
+
+  if (InBuffer.size() - InPosition < DataSize)
+  {
+    Incomplete = true;
+    return 0;
+  }
+  memcpy(Data, InBuffer.data() + InPosition, DataSize);
+  InPosition += DataSize;
+  return DataSize;
+}
+
+// GameServerClientThread ------------------------------------------------------
+
+GameServerClientThread::GameServerClientThread(GameServerClient* Parent)
+{
+  Client = Parent;
+  Resume();
+}
+
+unsigned int GameServerClientThread::Run()
+{
+  /* Exchange version information with the client */
+  if (Client->SendVersion() && GameServerClient::ReceiveVersion(Client) > 0)
+    while (GameServerClient::ReceiveData(Client) > 0);
+
+  /* Remove the player from the server, which frees the client once this thread is done */
+  Client->Disconnect();
+  Client->Server->RetireClient(Client);
 
   return 0;
 }
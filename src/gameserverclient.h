@@ -20,10 +20,16 @@
 #ifndef GAMESERVERCLIENT_H_
 #define GAMESERVERCLIENT_H_
 
+#include "gameservercongestion.h"
 #include "gameserverdata.h"
+#include "gameserverevent.h"
 #include "gameserver.h"
+#include "gameservermessage.h"
 #include "system.h"
+#include "timingwheel.h"
 #include <limits.h>
+#include <list>
+#include <mstcpip.h>
 #include <string>
 #include <tcpclientsocket.h>
 #include <tcpserversocket.h>
@@ -34,24 +40,51 @@ using namespace std;
 struct GameServerRoom;
 
 class GameServer; /* because of circular reference */
+class GameServerClientThread;
+class GameServerReactor;
 
-class GameServerClient : public Thread
+class GameServerClient
 {
 public:
+  static const unsigned long MaxBufferSize;
+
+  /* Outbound queues statistics, web interface only */
+  static volatile LONG QueuedMessages;
+  static volatile LONG QueuedBytes;
+  static volatile LONG MaxQueuedBytes;
+  static volatile LONG Overflows;
+  static volatile LONG DroppedMessages;
+  static volatile LONG CoalescedMessages;
+  static volatile LONG SentMessages[GameServerMessage::TypeCount];
+  static volatile LONG SendCalls[GameServerMessage::TypeCount];
+
   unsigned int Id;
   string Name;
+  unsigned int ObserverIndex; /* Position in the room's observers */
   bool Ready;
+  bool Relaying;              /* A relay server forwarding the room */
+  bool Subscribed;            /* To the lobby's changes, guarded by the server */
+  GameServerReactor* Reactor;
   GameServerRoom* Room;
+  GameServerReactor* volatile Shard; /* The room's, set with it so that the reactors read it without locking */
   bool Synchronised;
   int Version;
+  volatile DWORD LastActivity; /* When the last message was received */
+  TimingWheelTimer Deadline;   /* Owned by the server */
 
   GameServerClient(GameServer* Parent, SOCKET Socket, unsigned int ClientId);
   ~GameServerClient();
 
+  void Close();
   long ConnectionTime();
+  void Disconnect();
+  unsigned long GetAddress();
+  bool IsConnected();
+  bool ReceiveBuffer(const char* Data, const unsigned long DataSize);
+  bool Send(const GameServerMessage& Message);
   bool SendGameData(const void* Data, const unsigned long DataSize);
   bool SendHostChanged(const unsigned int Id);
-  bool SendMessage(const unsigned int PlayerId, const string Message);
+  bool SendMessage(const unsigned int PlayerId, const string Text);
   bool SendMove(const unsigned long Data);
   bool SendName(const unsigned int PlayerId, const string PlayerName);
   bool SendNetworkRequest(const NetworkRequestType Request);
@@ -65,12 +98,70 @@ public:
   bool SendPromoteTo(const int Type);
   bool SendRoomInfo(const unsigned int RoomId, const string RoomName, const bool RoomPrivate, const int PlayerCount);
   bool SendTime(const unsigned int PlayerId, const unsigned long Time);
+  bool SendVersion();
+  void Start();
 
 private:
   GameServer* Server;
   TCPClientSocket* Socket;
+  SOCKET SocketHandle;
+  GameServerClientThread* ClientThread;
+  bool Closed;
+  bool Connected;
+  volatile LONG References;
+
+  /* Compact protocol, each message is read as a whole frame first */
+  bool Compact;
+  bool Compression; /* Receives the compressed copy of the game data */
+  bool Framed;
+  string Frame;
+  unsigned long FramePosition;
+
+  /* Data received by a reactor, not used when the client has its own thread */
+  bool Buffered;
+  bool Incomplete;
+  string InBuffer;
+  unsigned long InPosition;
+
+  /* Data waiting to be sent by the reactor */
+  CRITICAL_SECTION QueueLock;
+  list<GameServerMessage> OutQueue;
+  unsigned long OutQueueOffset;
+  unsigned long OutQueueSize;
+  unsigned long OutQueueInFlight; /* Messages given to the pending send */
+  bool Sending;
+  bool Stalled;                   /* Queue above its maximum size */
+  DWORD StallTimestamp;
+
+  /* Pending reactor operations */
+  GameServerEvent PendingHandoff;
+  GameServerEvent PendingReceive;
+  GameServerEvent PendingSend;
+  char ReceiveChunk[1024];
+
+  bool Coalesce(const GameServerMessage& Message);
+  const string& Encode(const GameServerMessage& Message) const;
+  bool ReceiveFrame();
+  long ReceiveInteger();
+  char* ReceiveString();
+  unsigned long ReceiveBytes(void* Data, const unsigned long DataSize);
+
+  static int ReceiveData(GameServerClient* Client);
+  static int ReceiveVersion(GameServerClient* Client);
+
+  friend class GameServerClientThread;
+  friend class GameServerReactor;
+};
+
+/* Thread that reads from a client's socket when no reactor is used */
+class GameServerClientThread : public Thread
+{
+public:
+  GameServerClientThread(GameServerClient* Parent);
+
+private:
+  GameServerClient* Client;
 
-  static int ReceiveData(GameServerClient* Player);
   unsigned int Run();
 };
 
@@ -0,0 +1,83 @@
+/*
+* GameServerCommand.cpp - Command posted by a player to a room's inbox.
+*
+* Copyright (C) 2007-2011 Marc-André Lamothe.
+*
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU Library General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, write to the Free Software
+* Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+*/
+#include "gameservercommand.h"
+
+// Public functions ------------------------------------------------------------
+
+GameServerCommandQueue::GameServerCommandQueue()
+{
+  Stub.Next = NULL;
+  Stub.Message = NULL;
+  Head = &Stub;
+  Tail = &Stub;
+}
+
+GameServerCommandQueue::~GameServerCommandQueue()
+{
+  GameServerCommand* Command;
+  while ((Command = Pop()) != NULL)
+  {
+    if (Command->Message != NULL)
+      delete Command->Message;
+    delete Command;
+  }
+}
+
+GameServerCommand* GameServerCommandQueue::Pop()
+{
+  GameServerCommand* Command = Tail;
+  GameServerCommand* Next = Command->Next;
+
+  /* Skip the stub, it is only there so that the queue is never empty */
+  if (Command == &Stub)
+  {
+    if (Next == NULL)
+      return NULL;
+    Tail = Next;
+    Command = Next;
+    Next = Next->Next;
+  }
+  if (Next != NULL)
+  {
+    Tail = Next;
+    return Command;
+  }
+
+  /* A producer is between exchanging the head and linking its command */
+  if (Command != Head)
+    return NULL;
+
+  /* Put the stub back behind the last command so that it can be removed */
+  Push(&Stub);
+  Next = Command->Next;
+  if (Next != NULL)
+  {
+    Tail = Next;
+    return Command;
+  }
+  return NULL;
+}
+
+void GameServerCommandQueue::Push(GameServerCommand* Command)
+{
+  Command->Next = NULL;
+  GameServerCommand* Previous = (GameServerCommand*)InterlockedExchangePointer((PVOID volatile*)&Head, Command);
+  Previous->Next = Command;
+}
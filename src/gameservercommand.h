@@ -0,0 +1,62 @@
+/*
+* GameServerCommand.h - Command posted by a player to a room's inbox.
+*
+* Copyright (C) 2007-2011 Marc-André Lamothe.
+*
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU Library General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, write to the Free Software
+* Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+*/
+#ifndef GAMESERVERCOMMAND_H_
+#define GAMESERVERCOMMAND_H_
+
+#include "gameservermessage.h"
+#include "system.h"
+#include <string>
+
+using namespace std;
+
+class GameServerClient; /* because of circular reference */
+
+enum GameServerCommandType {ChangeSeatCommand, CloseCommand, EndGameCommand, GameDataCommand, MessageCommand, MoveCommand, NotificationCommand, PlayerNotificationCommand, PromotionCommand, ReadyCommand, RequestCommand, TimeCommand};
+
+struct GameServerCommand
+{
+  GameServerCommand* volatile Next;
+  GameServerCommandType Type;
+  GameServerClient* Client;
+  unsigned long Value;
+  unsigned long Time;
+  string Data;
+  GameServerMessage* Message; /* Already encoded, owned by the command */
+};
+
+/* Intrusive multiple producers, single consumer queue. Any thread can push
+ * without locking, only the thread running the room pops. A pop may return
+ * NULL while a push is still in progress, the consumer then tries again. */
+class GameServerCommandQueue
+{
+public:
+  GameServerCommandQueue();
+  ~GameServerCommandQueue();
+
+  GameServerCommand* Pop();
+  void Push(GameServerCommand* Command);
+
+private:
+  GameServerCommand Stub;
+  GameServerCommand* volatile Head;
+  GameServerCommand* Tail;
+};
+
+#endif
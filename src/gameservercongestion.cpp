@@ -0,0 +1,50 @@
+/*
+* GameServerCongestion.cpp - Policy applied to the clients' congested outbound queues.
+*
+* Copyright (C) 2007-2011 Marc-André Lamothe.
+*
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU Library General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, write to the Free Software
+* Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+*/
+#include "gameservercongestion.h"
+
+/* Initialise static class members */
+const unsigned long GameServerCongestion::CongestedQueueSize = 262144;
+const unsigned long GameServerCongestion::MaxQueueSize = 1048576;
+const unsigned long GameServerCongestion::MaxPlayerQueueSize = 4194304;
+const unsigned long GameServerCongestion::GracePeriod = 15000;
+
+// Public functions ------------------------------------------------------------
+
+CongestionAction GameServerCongestion::Admit(const NetworkData Type, const bool Seated, const unsigned long QueueSize, const unsigned long DataSize, const bool Stalled, const unsigned long StallTime, const bool Coalescing)
+{
+  /* Coalescing replaces a queued copy of the message, the caller asks again
+     without it when there is none */
+  bool Congested = (QueueSize > CongestedQueueSize);
+  if (Congested && Type == ND_Message && !Seated)
+    return DropMessage;
+  if (Congested && Coalescing && (Type == ND_PlayerTime || Type == ND_RoomInfo))
+    return CoalesceMessage;
+  if (QueueSize + DataSize > (Seated ? MaxPlayerQueueSize : MaxQueueSize))
+    return CloseClient;
+  if (Seated && Stalled && StallTime > GracePeriod)
+    return CloseClient;
+  return QueueMessage;
+}
+
+bool GameServerCongestion::Stalls(const unsigned long QueueSize)
+{
+  /* A queue past the maximum size starts its grace period */
+  return (QueueSize > MaxQueueSize);
+}
@@ -0,0 +1,45 @@
+/*
+* GameServerCongestion.h - Policy applied to the clients' congested outbound queues.
+*
+* Copyright (C) 2007-2011 Marc-André Lamothe.
+*
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU Library General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, write to the Free Software
+* Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+*/
+#ifndef GAMESERVERCONGESTION_H_
+#define GAMESERVERCONGESTION_H_
+
+#include "gameserverdata.h"
+
+/* What becomes of a message sent to a client, given its outbound queue */
+enum CongestionAction {QueueMessage, DropMessage, CoalesceMessage, CloseClient};
+
+/* Outbound queue limits. Above the congestion size observers stop getting
+ * the chat and a player's queued times are replaced by newer ones. Above
+ * the maximum size observers are disconnected, players keep their seat for
+ * a grace period as long as their queue stays below its own limit. Only
+ * the players of a game are seated, a relay has an observer's limits. */
+class GameServerCongestion
+{
+public:
+  static const unsigned long CongestedQueueSize;
+  static const unsigned long MaxQueueSize;
+  static const unsigned long MaxPlayerQueueSize;
+  static const unsigned long GracePeriod; /* In milliseconds */
+
+  static CongestionAction Admit(const NetworkData Type, const bool Seated, const unsigned long QueueSize, const unsigned long DataSize, const bool Stalled, const unsigned long StallTime, const bool Coalescing = true);
+  static bool Stalls(const unsigned long QueueSize);
+};
+
+#endif
@@ -29,7 +29,17 @@ enum NetworkData
   /* Data sent by both the client & the server */
   ND_Disconnection, ND_GameData, ND_Message, ND_Move, ND_Name, ND_NetworkRequest, ND_Notification, ND_PlayerRequest, ND_PlayerTime, ND_PromoteTo,
   /* Data sent by the server only */
-  ND_GameDataUpdate, ND_HostChanged, ND_PlayerId, ND_PlayerType, ND_PlayerJoined, ND_PlayerLeft, ND_PlayerReady, ND_RoomInfo
+  ND_GameDataUpdate, ND_HostChanged, ND_PlayerId, ND_PlayerType, ND_PlayerJoined, ND_PlayerLeft, ND_PlayerReady, ND_RoomInfo,
+  /* Data sent by relay servers only */
+  ND_RelayRoom,
+  /* Data sent by the server only, to clients supporting compression */
+  ND_CompressedGameData,
+  /* Data sent by the server only, to the lobby's subscribers */
+  ND_RoomRemoved,
+  /* Data sent by the server only, ending the page of a room query */
+  ND_RoomQueryResult,
+  /* Data sent by the server only, answering a name query */
+  ND_NameQueryResult
 };
 
 /* Type of notification */
@@ -41,11 +51,21 @@ enum NotificationType
   /* Notification sent by the client and the server */
   GamePaused, GameResumed, DrawRequestAccepted, DrawRequestRejected, TakebackRequestAccepted, TakebackRequestRejected,
   /* Notification sent by the server only */
-  GameStarted, GameDrawed, JoinedRoom, LeftRoom, Resigned, TookbackMove
+  GameStarted, GameDrawed, JoinedRoom, LeftRoom, Resigned, TookbackMove,
+  /* Notification sent to relay servers only, ending the room's state */
+  RoomStateSent,
+  /* Notification sent by the server only, when it ended the game itself */
+  Checkmated, FlagFell
 };
 
 /* Type of network request */
-enum NetworkRequestType {NullNetworkRequest, GameData, RoomList};
+enum NetworkRequestType {NullNetworkRequest, GameData, RoomList, SubscribeLobby, UnsubscribeLobby, RoomQuery, NameQuery};
+
+/* Filters of a room query, combined */
+enum RoomFilter {NullRoomFilter, PublicRooms = 1, WaitingRooms = 2, OpenRooms = 4};
+
+/* Names searched by a name query */
+enum NameQueryType {NullNameQuery, RoomNameQuery, PlayerNameQuery};
 
 /* Type of player request */
 enum PlayerRequestType {NullPlayerRequest, DrawRequest, TakebackRequest};
@@ -0,0 +1,34 @@
+/*
+* GameServerEvent.h - Operation queued on a reactor's completion port.
+*
+* Copyright (C) 2007-2011 Marc-André Lamothe.
+*
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU Library General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, write to the Free Software
+* Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+*/
+#ifndef GAMESERVEREVENT_H_
+#define GAMESERVEREVENT_H_
+
+#include "system.h"
+
+/* Type of operation queued on a reactor's completion port */
+enum GameServerEventType {ReceiveEvent, HandoffEvent, FlushEvent, SendEvent, RoomEvent};
+
+struct GameServerEvent
+{
+  OVERLAPPED Overlapped;
+  GameServerEventType Type;
+};
+
+#endif
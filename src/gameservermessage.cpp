@@ -0,0 +1,170 @@
+/*
+* GameServerMessage.cpp - Message sent by the game server to a player.
+*
+* Copyright (C) 2007-2011 Marc-André Lamothe.
+*
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU Library General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, write to the Free Software
+* Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+*/
+#include "gameservermessage.h"
+
+// Public functions ------------------------------------------------------------
+
+GameServerMessage::GameServerMessage(const NetworkData MessageType)
+{
+  Shared = new SharedData;
+  Shared->Type = MessageType;
+  Shared->Compressed = NULL;
+  Shared->References = 1;
+
+  /* The version information sent on connection has no type */
+  if (MessageType != ND_NULL)
+    AddInteger(MessageType);
+}
+
+GameServerMessage::GameServerMessage(const GameServerMessage& Message)
+{
+  Shared = Message.Shared;
+  InterlockedIncrement(&Shared->References);
+}
+
+GameServerMessage::~GameServerMessage()
+{
+  Release();
+}
+
+GameServerMessage& GameServerMessage::operator=(const GameServerMessage& Message)
+{
+  if (Shared != Message.Shared)
+  {
+    InterlockedIncrement(&Message.Shared->References);
+    Release();
+    Shared = Message.Shared;
+  }
+  return *this;
+}
+
+void GameServerMessage::AddBytes(const void* Data, const unsigned long DataSize)
+{
+  Shared->Buffer.append((const char*)Data, DataSize);
+  AddFrame((const char*)Data, DataSize);
+}
+
+void GameServerMessage::AddInteger(const long Value)
+{
+  u_long NetworkValue = htonl((u_long)Value);
+  Shared->Buffer.append((const char*)&NetworkValue, sizeof(NetworkValue));
+  string Varint;
+  AppendVarint(Varint, (u_long)Value);
+  AddFrame(Varint.data(), Varint.size());
+}
+
+void GameServerMessage::AddString(const string& Value)
+{
+  AddInteger(Value.size());
+  Shared->Buffer.append(Value);
+  AddFrame(Value.data(), Value.size());
+}
+
+void GameServerMessage::Append(const GameServerMessage& Message)
+{
+  Shared->Buffer.append(Message.GetData());
+  Shared->Frame.append(Message.GetFrame());
+}
+
+const GameServerMessage& GameServerMessage::GetCompressed() const
+{
+  if (Shared->Compressed != NULL)
+    return *Shared->Compressed;
+  return *this;
+}
+
+const string& GameServerMessage::GetData() const
+{
+  return Shared->Buffer;
+}
+
+const string& GameServerMessage::GetFrame() const
+{
+  return Shared->Frame;
+}
+
+NetworkData GameServerMessage::GetType() const
+{
+  return Shared->Type;
+}
+
+void GameServerMessage::SetCompressed(const GameServerMessage& Message)
+{
+  if (Shared->Compressed != NULL)
+    *Shared->Compressed = Message;
+  else
+    Shared->Compressed = new GameServerMessage(Message);
+}
+
+// Public static functions -----------------------------------------------------
+
+bool GameServerMessage::ReadVarint(const string& Buffer, unsigned long& Position, unsigned long& Value)
+{
+  /* A 32 bits value takes 5 bytes at most, a longer or truncated one is invalid */
+  Value = 0;
+  for (unsigned int Shift = 0; Shift <= 28 && Position < Buffer.size(); Shift += 7)
+  {
+    unsigned char Byte = Buffer[Position++];
+    Value |= (unsigned long)(Byte & 0x7F) << Shift;
+    if ((Byte & 0x80) == 0)
+      return true;
+  }
+  return false;
+}
+
+// Private static functions ----------------------------------------------------
+
+void GameServerMessage::AppendVarint(string& Buffer, unsigned long Value)
+{
+  while (Value >= 0x80)
+  {
+    Buffer += (char)((Value & 0x7F) | 0x80);
+    Value >>= 7;
+  }
+  Buffer += (char)Value;
+}
+
+// Private functions -----------------------------------------------------------
+
+void GameServerMessage::AddFrame(const char* Data, const unsigned long DataSize)
+{
+  /* A message without a type has no frame of its own. The length prefix is
+     written again in place, it only moves the fields when it needs another
+     byte, every 7 bits of length. */
+  if (Shared->Type == ND_NULL)
+    return;
+  unsigned long Position = 0;
+  unsigned long Size = 0;
+  ReadVarint(Shared->Frame, Position, Size);
+  string Prefix;
+  AppendVarint(Prefix, Size + DataSize);
+  Shared->Frame.replace(0, Position, Prefix);
+  Shared->Frame.append(Data, DataSize);
+}
+
+void GameServerMessage::Release()
+{
+  if (InterlockedDecrement(&Shared->References) == 0)
+  {
+    if (Shared->Compressed != NULL)
+      delete Shared->Compressed;
+    delete Shared;
+  }
+}
@@ -0,0 +1,89 @@
+/*
+* GameServerMessage.h - Message sent by the game server to a player.
+*
+* Copyright (C) 2007-2011 Marc-André Lamothe.
+*
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU Library General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, write to the Free Software
+* Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+*/
+#ifndef GAMESERVERMESSAGE_H_
+#define GAMESERVERMESSAGE_H_
+
+#include "gameserverdata.h"
+#include "system.h"
+#include <string>
+
+using namespace std;
+
+/* A complete message encoded in a single buffer, so that it can be sent with
+ * one call. The encoding is the same as TCPClientSocket: integers are 32 bits
+ * in network byte order and strings are prefixed by their length.
+ *
+ * The message is encoded for the compact protocol as well, used by clients
+ * from version 500. Each message is a frame prefixed by its length, its
+ * integers are varints of 7 bits groups, lowest first, the high bit of each
+ * byte telling if another one follows. Strings are prefixed by their length.
+ *
+ * A message may carry a compressed copy of itself, sent instead to the
+ * clients that support compression. A message without a type is sent as is,
+ * either the version information or a batch of complete messages appended
+ * to it, which holds their frames as well.
+ *
+ * Copies of a message share the same reference counted buffer, a message
+ * broadcast to a room is encoded once and only referenced by each queue.
+ * Both encodings are complete after each field added, reading a message
+ * never modifies it, so that its copies can be sent from any thread. The
+ * buffer must not be modified once the message has been copied. */
+class GameServerMessage
+{
+public:
+  static const unsigned int TypeCount = 32;
+
+  GameServerMessage(const NetworkData MessageType = ND_NULL);
+  GameServerMessage(const GameServerMessage& Message);
+  ~GameServerMessage();
+
+  GameServerMessage& operator=(const GameServerMessage& Message);
+
+  void AddBytes(const void* Data, const unsigned long DataSize);
+  void AddInteger(const long Value);
+  void AddString(const string& Value);
+  void Append(const GameServerMessage& Message);
+  const GameServerMessage& GetCompressed() const;
+  const string& GetData() const;
+  const string& GetFrame() const;
+  NetworkData GetType() const;
+  void SetCompressed(const GameServerMessage& Message);
+
+  static bool ReadVarint(const string& Buffer, unsigned long& Position, unsigned long& Value);
+
+private:
+  struct SharedData
+  {
+    string Buffer;
+    string Frame; /* Compact frame, its length prefix kept up to date */
+    GameServerMessage* Compressed;
+    NetworkData Type;
+    volatile LONG References;
+  };
+
+  SharedData* Shared;
+
+  void AddFrame(const char* Data, const unsigned long DataSize);
+  void Release();
+
+  static void AppendVarint(string& Buffer, unsigned long Value);
+};
+
+#endif
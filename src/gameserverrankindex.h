@@ -0,0 +1,99 @@
+/*
+* GameServerRankIndex.h - Set of slots that finds its elements by rank.
+*
+* Copyright (C) 2007-2011 Marc-André Lamothe.
+*
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU Library General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, write to the Free Software
+* Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+*/
+#ifndef GAMESERVERRANKINDEX_H_
+#define GAMESERVERRANKINDEX_H_
+
+#include <vector>
+
+using namespace std;
+
+/* Set of slot indexes, from 1, kept as a binary indexed tree of the number
+ * of slots present in each range, so that the element at a given rank is
+ * found in logarithmic time as well as inserted or erased. The elements are
+ * ordered by slot. The tree's size is a power of two, it is doubled as the
+ * slots grow, which only requires its root to count every element. */
+class GameServerRankIndex
+{
+public:
+  GameServerRankIndex()
+  {
+    Total = 0;
+  }
+
+  void Clear()
+  {
+    Counts.clear();
+    Total = 0;
+  }
+
+  /* Returns the slot of the element at the rank, from 0, or 0 if there is none */
+  unsigned int Find(unsigned long Rank) const
+  {
+    if (Rank >= Total)
+      return 0;
+    unsigned int Position = 0;
+    for (unsigned int Step = Counts.size(); Step > 0; Step >>= 1)
+    {
+      if (Counts[Position+Step-1] <= Rank)
+      {
+        Rank -= Counts[Position+Step-1];
+        Position += Step;
+      }
+    }
+    return Position + 1;
+  }
+
+  void Insert(const unsigned int Slot)
+  {
+    if (Slot == 0)
+      return;
+    while (Slot > Counts.size())
+    {
+      /* The new ranges are empty, but for the root that covers them all */
+      Counts.resize(Counts.empty() ? 1 : Counts.size() * 2, 0);
+      Counts.back() = Total;
+    }
+    Update(Slot, 1);
+  }
+
+  void Erase(const unsigned int Slot)
+  {
+    if (Slot > 0 && Slot <= Counts.size())
+      Update(Slot, -1);
+  }
+
+  unsigned int Size() const
+  {
+    return Total;
+  }
+
+private:
+  vector<unsigned int> Counts; /* Elements in the range ending at each slot */
+  unsigned int Total;
+
+  void Update(unsigned int Slot, int Delta)
+  {
+    for (; Slot <= Counts.size(); Slot += Slot & (~Slot + 1))
+      Counts[Slot-1] += Delta;
+    Total += Delta;
+  }
+};
+
+#endif
@@ -0,0 +1,275 @@
+/*
+* GameServerReactor.cpp - Completion port that drives the players connections.
+*
+* Copyright (C) 2007-2011 Marc-André Lamothe.
+*
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU Library General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, write to the Free Software
+* Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+*/
+#include "gameserverreactor.h"
+
+// Public functions ------------------------------------------------------------
+
+GameServerReactor::GameServerReactor(unsigned int ThreadCount, int Processor)
+{
+  CompletionPort = CreateIoCompletionPort(INVALID_HANDLE_VALUE, NULL, 0, ThreadCount);
+
+  /* Start the threads that process the completed operations */
+  if (CompletionPort != NULL)
+    for (unsigned int i = 0; i < ThreadCount; i++)
+      Threads.push_back(new GameServerReactorThread(this, Processor));
+}
+
+GameServerReactor::~GameServerReactor()
+{
+  /* Wake up every thread so that they can exit */
+  list<GameServerReactorThread*>::iterator it;
+  for (it = Threads.begin(); it != Threads.end(); it++)
+    PostQueuedCompletionStatus(CompletionPort, 0, 0, NULL);
+  for (it = Threads.begin(); it != Threads.end(); it++)
+    delete *it;
+  Threads.clear();
+
+  if (CompletionPort != NULL)
+    CloseHandle(CompletionPort);
+}
+
+void GameServerReactor::Acquire(GameServerClient* Client)
+{
+  /* Keep the client alive while something other than its own operations refers to it */
+  InterlockedIncrement(&Client->References);
+}
+
+bool GameServerReactor::AddClient(GameServerClient* Client, bool Receiving)
+{
+  if (Client == NULL || CompletionPort == NULL)
+    return false;
+
+  /* Associate the client's socket with the completion port */
+  if (CreateIoCompletionPort((HANDLE)Client->SocketHandle, CompletionPort, (ULONG_PTR)Client, 0) == NULL)
+    return false;
+  Client->Buffered = Receiving;
+  Client->Reactor = this;
+  Client->References = 1;
+
+  /* A client with its own thread only uses the reactor to send its data */
+  if (!Receiving)
+    return true;
+
+  /* Exchange version information with the client */
+  if (!Client->SendVersion())
+    return false;
+  return Receive(Client);
+}
+
+bool GameServerReactor::Flush(GameServerClient* Client)
+{
+  /* Start sending the client's queue from one of the reactor's threads */
+  InterlockedIncrement(&Client->References);
+  memset(&Client->PendingSend, 0, sizeof(Client->PendingSend));
+  Client->PendingSend.Type = FlushEvent;
+  if (PostQueuedCompletionStatus(CompletionPort, 0, (ULONG_PTR)Client, &Client->PendingSend.Overlapped) == FALSE)
+  {
+    Send(Client, false, 0, false);
+    return false;
+  }
+  return true;
+}
+
+unsigned int GameServerReactor::GetProcessorCount()
+{
+  SYSTEM_INFO Info;
+  GetSystemInfo(&Info);
+  return (Info.dwNumberOfProcessors > 0 ? Info.dwNumberOfProcessors : 1);
+}
+
+void GameServerReactor::Release(GameServerClient* Client)
+{
+  /* Delete the client once it has no pending operation */
+  if (InterlockedDecrement(&Client->References) == 0)
+    delete Client;
+}
+
+bool GameServerReactor::Schedule(GameServerRoom* Room)
+{
+  /* Run the room's commands on one of the reactor's threads */
+  memset(&Room->PendingRun, 0, sizeof(Room->PendingRun));
+  Room->PendingRun.Type = RoomEvent;
+  return (PostQueuedCompletionStatus(CompletionPort, 0, (ULONG_PTR)Room, &Room->PendingRun.Overlapped) != FALSE);
+}
+
+// Private functions -----------------------------------------------------------
+
+bool GameServerReactor::Handoff(GameServerClient* Client, unsigned long DataSize)
+{
+  /* Queue the received data on this shard, the completion port serves as the shard's queue */
+  memset(&Client->PendingHandoff, 0, sizeof(Client->PendingHandoff));
+  Client->PendingHandoff.Type = HandoffEvent;
+  return (PostQueuedCompletionStatus(CompletionPort, DataSize, (ULONG_PTR)Client, &Client->PendingHandoff.Overlapped) != FALSE);
+}
+
+void GameServerReactor::ProcessEvent(GameServerClient* Client, GameServerEvent* Event, unsigned long DataSize, bool Success)
+{
+  switch (Event->Type)
+  {
+    case ReceiveEvent:
+    {
+      /* Rooms are pinned to the shard of their creator, hand the data off to
+         the room's shard so that all of its players are processed there. The
+         room may be deleted meanwhile, the client keeps its shard, which
+         outlives it. */
+      GameServerReactor* Shard = Client->Shard;
+      if (Success && DataSize > 0 && Shard != NULL && Shard != this)
+        if (Shard->Handoff(Client, DataSize))
+          break;
+      /* Otherwise process the data on this shard */
+    }
+    case HandoffEvent:
+    {
+      /* Process the received data and wait for more */
+      if (Success && DataSize > 0 && Client->ReceiveBuffer(Client->ReceiveChunk, DataSize) && Receive(Client))
+        break;
+
+      /* Remove the player from the server */
+      Client->Disconnect();
+      Release(Client);
+      break;
+    }
+    case FlushEvent:
+    case SendEvent:
+    {
+      Send(Client, Event->Type == SendEvent, DataSize, Success);
+      break;
+    }
+    case RoomEvent:
+      break;
+  }
+}
+
+bool GameServerReactor::Receive(GameServerClient* Client)
+{
+  WSABUF Buffer;
+  Buffer.buf = Client->ReceiveChunk;
+  Buffer.len = sizeof(Client->ReceiveChunk);
+  DWORD Flags = 0;
+
+  /* Queue a single receive operation, the client is only processed by one thread at a time */
+  memset(&Client->PendingReceive, 0, sizeof(Client->PendingReceive));
+  Client->PendingReceive.Type = ReceiveEvent;
+  if (WSARecv(Client->SocketHandle, &Buffer, 1, NULL, &Flags, &Client->PendingReceive.Overlapped, NULL) == SOCKET_ERROR)
+    return (WSAGetLastError() == WSA_IO_PENDING);
+  return true;
+}
+
+void GameServerReactor::Send(GameServerClient* Client, bool Completed, unsigned long DataSize, bool Success)
+{
+  bool Pending = false;
+
+  EnterCriticalSection(&Client->QueueLock);
+  if (Completed && Success)
+  {
+    /* Remove the messages that were sent from the queue */
+    Client->OutQueueSize -= DataSize;
+    InterlockedExchangeAdd(&GameServerClient::QueuedBytes, -(LONG)DataSize);
+    unsigned long Sent = Client->OutQueueOffset + DataSize;
+    while (!Client->OutQueue.empty() && Sent >= Client->Encode(Client->OutQueue.front()).size())
+    {
+      Sent -= Client->Encode(Client->OutQueue.front()).size();
+      InterlockedIncrement(&GameServerClient::SentMessages[Client->OutQueue.front().GetType() % GameServerMessage::TypeCount]);
+      InterlockedDecrement(&GameServerClient::QueuedMessages);
+      Client->OutQueue.pop_front();
+    }
+    Client->OutQueueOffset = Sent;
+    Client->OutQueueInFlight = 0;
+    if (Client->OutQueueSize <= GameServerCongestion::MaxQueueSize)
+      Client->Stalled = false;
+  }
+  if (Success && !Client->Closed && !Client->OutQueue.empty())
+  {
+    /* Send as many consecutive messages as possible with a single call */
+    WSABUF Buffers[MaxBuffers];
+    bool Types[GameServerMessage::TypeCount] = {false};
+    DWORD Count = 0;
+    list<GameServerMessage>::iterator it;
+    for (it = Client->OutQueue.begin(); it != Client->OutQueue.end() && Count < MaxBuffers; it++)
+    {
+      unsigned long Offset = (Count == 0 ? Client->OutQueueOffset : 0);
+      const string& Data = Client->Encode(*it);
+      Buffers[Count].buf = (char*)Data.data() + Offset;
+      Buffers[Count].len = Data.size() - Offset;
+      Types[it->GetType() % GameServerMessage::TypeCount] = true;
+      Count++;
+    }
+    memset(&Client->PendingSend, 0, sizeof(Client->PendingSend));
+    Client->PendingSend.Type = SendEvent;
+    if (WSASend(Client->SocketHandle, Buffers, Count, NULL, 0, &Client->PendingSend.Overlapped, NULL) != SOCKET_ERROR || WSAGetLastError() == WSA_IO_PENDING)
+    {
+      Pending = true;
+      Client->OutQueueInFlight = Count;
+      for (unsigned int i = 0; i < GameServerMessage::TypeCount; i++)
+        if (Types[i])
+          InterlockedIncrement(&GameServerClient::SendCalls[i]);
+    }
+    else
+      Success = false;
+  }
+  if (!Pending)
+    Client->Sending = false;
+  LeaveCriticalSection(&Client->QueueLock);
+
+  if (!Pending)
+  {
+    /* Close the connection on error so that the client gets removed */
+    if (!Success)
+      Client->Close();
+    Release(Client);
+  }
+}
+
+// GameServerReactorThread -----------------------------------------------------
+
+GameServerReactorThread::GameServerReactorThread(GameServerReactor* Parent, int ProcessorId)
+{
+  Reactor = Parent;
+  Processor = ProcessorId;
+  Resume();
+}
+
+unsigned int GameServerReactorThread::Run()
+{
+  /* Pin the thread to its shard's processor */
+  if (Processor >= 0)
+    SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR)1 << (Processor % (sizeof(DWORD_PTR)*8)));
+
+  while (IsActive())
+  {
+    DWORD DataSize = 0;
+    ULONG_PTR Key = 0;
+    OVERLAPPED* Overlapped = NULL;
+    BOOL Result = GetQueuedCompletionStatus(Reactor->CompletionPort, &DataSize, &Key, &Overlapped, INFINITE);
+
+    /* An empty completion is posted when the reactor is stopping */
+    if (Overlapped == NULL)
+      break;
+
+    /* The overlapped structure is the first member of the event, rooms are
+       posted with their own key */
+    GameServerEvent* Event = (GameServerEvent*)Overlapped;
+    if (Event->Type == RoomEvent)
+      ((GameServerRoom*)Key)->Server->RunRoom((GameServerRoom*)Key);
+    else
+      Reactor->ProcessEvent((GameServerClient*)Key, Event, DataSize, Result != FALSE);
+  }
+  return 0;
+}
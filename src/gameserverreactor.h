@@ -0,0 +1,74 @@
+/*
+* GameServerReactor.h - Completion port that drives the players connections.
+*
+* Copyright (C) 2007-2011 Marc-André Lamothe.
+*
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU Library General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, write to the Free Software
+* Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+*/
+#ifndef GAMESERVERREACTOR_H_
+#define GAMESERVERREACTOR_H_
+
+#include "gameserverclient.h"
+#include "system.h"
+#include <list>
+#include <thread.h>
+
+using namespace std;
+
+class GameServerClient; /* because of circular reference */
+class GameServerReactorThread;
+struct GameServerRoom;
+
+class GameServerReactor
+{
+public:
+  GameServerReactor(unsigned int ThreadCount, int Processor = -1);
+  ~GameServerReactor();
+
+  void Acquire(GameServerClient* Client);
+  bool AddClient(GameServerClient* Client, bool Receiving = true);
+  bool Flush(GameServerClient* Client);
+  static unsigned int GetProcessorCount();
+  void Release(GameServerClient* Client);
+  bool Schedule(GameServerRoom* Room);
+
+private:
+  static const unsigned int MaxBuffers = 16;
+
+  HANDLE CompletionPort;
+  list<GameServerReactorThread*> Threads;
+
+  bool Handoff(GameServerClient* Client, unsigned long DataSize);
+  void ProcessEvent(GameServerClient* Client, GameServerEvent* Event, unsigned long DataSize, bool Success);
+  bool Receive(GameServerClient* Client);
+  void Send(GameServerClient* Client, bool Completed, unsigned long DataSize, bool Success);
+
+  friend class GameServerReactorThread;
+};
+
+/* Thread that waits on the reactor's completion port */
+class GameServerReactorThread : public Thread
+{
+public:
+  GameServerReactorThread(GameServerReactor* Parent, int ProcessorId);
+
+private:
+  GameServerReactor* Reactor;
+  int Processor;
+
+  unsigned int Run();
+};
+
+#endif
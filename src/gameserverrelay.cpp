@@ -0,0 +1,460 @@
+/*
+* GameServerRelay.cpp - Upstream connection of a room mirrored by a relay server.
+*
+* Copyright (C) 2007-2011 Marc-André Lamothe.
+*
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU Library General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, write to the Free Software
+* Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+*/
+#include "gameserverrelay.h"
+#include "gameserver.h"
+
+// Public functions ------------------------------------------------------------
+
+GameServerRelay::GameServerRelay(GameServer* Parent, GameServerRoom* Mirror, const string& Address, unsigned int UpstreamId)
+{
+  RoomId = UpstreamId;
+  Server = Parent;
+  Room = Mirror;
+
+  /* The address is a host name, optionally followed by a port */
+  string::size_type Separator = Address.find(':');
+  Host = Address.substr(0, Separator);
+  Port = (Separator != string::npos ? atoi(Address.c_str() + Separator + 1) : GameServer::Port);
+
+  /* The socket is made before the thread starts, only its connection is made by the thread */
+  Socket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+  Connected = false;
+  Requested = false;
+  Replaying = false;
+  RequestPending = 0;
+  RelayThread = new GameServerRelayThread(this);
+}
+
+GameServerRelay::~GameServerRelay()
+{
+  /* Shutting the socket down wakes up the thread if it is reading a message */
+  if (Socket != INVALID_SOCKET)
+    shutdown(Socket, SD_BOTH);
+  delete RelayThread;
+  if (Socket != INVALID_SOCKET)
+    closesocket(Socket);
+}
+
+unsigned int GameServerRelay::GetMemberCount()
+{
+  return Members.size();
+}
+
+void GameServerRelay::RequestState()
+{
+  /* Subscribing again makes the upstream server send the room's state, the
+     players already known are not forwarded twice. The thread sends the
+     request, the caller holds the room's lock. */
+  if (Connected && !Requested && !Replaying)
+  {
+    Requested = true;
+    Replaying = true;
+    InterlockedExchange(&RequestPending, 1);
+  }
+}
+
+void GameServerRelay::SendMembers(GameServerClient* Client)
+{
+  vector<Member>::iterator it;
+  for (it = Members.begin(); it != Members.end(); it++)
+  {
+    Client->SendPlayerJoined(it->Id, it->Name);
+    if (it->Type != ObserverType)
+      Client->SendPlayerType(it->Id, it->Type);
+  }
+}
+
+// Private functions -----------------------------------------------------------
+
+vector<GameServerRelay::Member>::iterator GameServerRelay::FindMember(unsigned int Id)
+{
+  vector<Member>::iterator it;
+  for (it = Members.begin(); it != Members.end() && it->Id != Id; it++);
+  return it;
+}
+
+bool GameServerRelay::Open()
+{
+  /* The host is either an address or a name */
+  sockaddr_in Address;
+  memset(&Address, 0, sizeof(Address));
+  Address.sin_family = AF_INET;
+  Address.sin_port = htons(Port);
+  Address.sin_addr.s_addr = inet_addr(Host.c_str());
+  if (Address.sin_addr.s_addr == INADDR_NONE)
+  {
+    hostent* Entry = gethostbyname(Host.c_str());
+    if (Entry == NULL || Entry->h_addr_list[0] == NULL)
+      return false;
+    memcpy(&Address.sin_addr, Entry->h_addr_list[0], sizeof(Address.sin_addr));
+  }
+  if (Socket == INVALID_SOCKET)
+    return false;
+  return (connect(Socket, (sockaddr*)&Address, sizeof(Address)) != SOCKET_ERROR);
+}
+
+bool GameServerRelay::Receive(void* Data, unsigned long DataSize)
+{
+  /* A message is read in full once its first bytes arrived */
+  char* Position = (char*)Data;
+  while (DataSize > 0)
+  {
+    int Result = recv(Socket, Position, DataSize, 0);
+    if (Result <= 0)
+      return false;
+    Position += Result;
+    DataSize -= Result;
+  }
+  return true;
+}
+
+long GameServerRelay::ReceiveInteger()
+{
+  u_long Value;
+  if (!Receive(&Value, sizeof(Value)))
+    return -1;
+  return (long)ntohl(Value);
+}
+
+bool GameServerRelay::ReceiveMessage()
+{
+  long Type = ReceiveInteger();
+  if (Type == -1)
+    return false;
+
+  /* Decode the message so that it can be encoded again, the encoding is the same */
+  GameServerMessage Message((NetworkData)Type);
+  long Values[3] = {0, 0, 0};
+  string Text;
+  switch (Type)
+  {
+    case ND_GameData:
+    {
+      Values[0] = ReceiveInteger();
+      if (Values[0] < 0 || (unsigned long)Values[0] > GameServerClient::MaxBufferSize)
+        return false;
+      Text.resize(Values[0]);
+      if (Values[0] > 0 && !Receive(&Text[0], Values[0]))
+        return false;
+      Message.AddInteger(Values[0]);
+      Message.AddBytes(Text.data(), Text.size());
+      Server->CompressGameData(Message, (const unsigned char*)Text.data(), Text.size());
+      break;
+    }
+    case ND_Message:
+    case ND_Name:
+    case ND_PlayerJoined:
+    {
+      Values[0] = ReceiveInteger();
+      if (!ReceiveString(Text))
+        return false;
+      Message.AddInteger(Values[0]);
+      Message.AddString(Text);
+      break;
+    }
+    case ND_PlayerTime:
+    case ND_PlayerType:
+    {
+      Values[0] = ReceiveInteger();
+      Values[1] = ReceiveInteger();
+      if (Values[1] == -1)
+        return false;
+      Message.AddInteger(Values[0]);
+      Message.AddInteger(Values[1]);
+      break;
+    }
+    case ND_HostChanged:
+    case ND_Move:
+    case ND_NetworkRequest:
+    case ND_Notification:
+    case ND_PlayerId:
+    case ND_PlayerLeft:
+    case ND_PlayerReady:
+    case ND_PlayerRequest:
+    case ND_PromoteTo:
+    {
+      Values[0] = ReceiveInteger();
+      if (Values[0] == -1)
+        return false;
+      Message.AddInteger(Values[0]);
+      break;
+    }
+    case ND_RoomInfo:
+    {
+      Values[0] = ReceiveInteger();
+      if (!ReceiveString(Text))
+        return false;
+      Values[1] = ReceiveInteger();
+      Values[2] = ReceiveInteger();
+      if (Values[2] == -1)
+        return false;
+      break;
+    }
+    default:
+      /* The rest of the stream can't be decoded */
+      return false;
+  }
+
+  /* Update the mirror and forward the message to the relay's observers */
+  bool Forward = true;
+  bool Changed = false;
+  Server->LockRoom(Room);
+  switch (Type)
+  {
+    case ND_GameData:
+    {
+      /* The data was sent for the relay, only the observers waiting for it
+         get it, once the replay is over when it is part of it */
+      Room->GameData = Message;
+      Room->GameDataCached = !Replaying;
+      Room->Journal.clear();
+      Requested = false;
+      if (!Replaying)
+        SendState();
+      Forward = false;
+      break;
+    }
+    case ND_Move:
+    case ND_PromoteTo:
+    {
+      if (Replaying)
+      {
+        /* Already known to the synchronised observers */
+        Room->Journal.push_back(Message);
+        Forward = false;
+      }
+      else
+        Server->JournalGameData(Room, Message);
+      break;
+    }
+    case ND_Notification:
+    {
+      if (Values[0] == LeftRoom)
+      {
+        /* The upstream room was deleted */
+        Connected = false;
+        Forward = false;
+      }
+      else if (Values[0] == RoomStateSent)
+      {
+        /* Without game data in the replay it comes later from the owner */
+        Replaying = false;
+        Forward = false;
+        if (!Requested)
+        {
+          Room->GameDataCached = true;
+          SendState();
+        }
+      }
+      else if (Values[0] == TookbackMove && Replaying)
+      {
+        Room->Journal.push_back(Message);
+        Forward = false;
+      }
+      else if (Values[0] == TookbackMove)
+        Server->JournalGameData(Room, Message);
+      else
+        Server->InvalidateGameData(Room);
+      break;
+    }
+    case ND_Name:
+    case ND_PlayerJoined:
+    {
+      vector<Member>::iterator it = FindMember(Values[0]);
+      if (it == Members.end())
+      {
+        Member NewMember;
+        NewMember.Id = Values[0];
+        NewMember.Name = Text;
+        NewMember.Type = ObserverType;
+        Members.push_back(NewMember);
+        Changed = true;
+      }
+      else if (it->Name != Text)
+        it->Name = Text;
+      else
+        Forward = false;
+      break;
+    }
+    case ND_PlayerLeft:
+    {
+      vector<Member>::iterator it = FindMember(Values[0]);
+      if (it != Members.end())
+      {
+        Members.erase(it);
+        Changed = true;
+      }
+      break;
+    }
+    case ND_PlayerType:
+    {
+      vector<Member>::iterator it = FindMember(Values[0]);
+      if (it != Members.end() && it->Type == (PlayerType)Values[1])
+        Forward = false;
+      else if (it != Members.end())
+        it->Type = (PlayerType)Values[1];
+      break;
+    }
+    case ND_RoomInfo:
+    {
+      Server->IndexName(Server->RoomNameIndex, Room->Id, Room->Name, Text);
+      Room->Name = Text;
+      Room->Private = (Values[1] != 0);
+      Changed = true;
+      Forward = false;
+      break;
+    }
+    case ND_HostChanged:
+    case ND_NetworkRequest:
+    case ND_PlayerId:
+    case ND_PlayerRequest:
+    {
+      /* Meant for the relay's connection itself */
+      Forward = false;
+      break;
+    }
+  }
+  if (Forward)
+    Server->SendToRoom(Room, Message);
+  if (Changed)
+  {
+    Server->PublishRoom(Room);
+    Server->IndexRoom(Room);
+  }
+  bool Result = Connected;
+  Server->UnlockRoom(Room);
+  return Result;
+}
+
+bool GameServerRelay::ReceiveString(string& Value)
+{
+  long Size = ReceiveInteger();
+  if (Size < 0 || (unsigned long)Size > GameServerClient::MaxBufferSize)
+    return false;
+  Value.resize(Size);
+  return (Size == 0 || Receive(&Value[0], Size));
+}
+
+bool GameServerRelay::Send(const GameServerMessage& Message)
+{
+  /* The relay speaks the fixed width protocol */
+  const string& Data = Message.GetData();
+  unsigned long Sent = 0;
+  while (Sent < Data.size())
+  {
+    int Result = send(Socket, Data.data() + Sent, Data.size() - Sent, 0);
+    if (Result == SOCKET_ERROR)
+      return false;
+    Sent += Result;
+  }
+  return true;
+}
+
+bool GameServerRelay::SendRequest()
+{
+  GameServerMessage Message(ND_RelayRoom);
+  Message.AddInteger(RoomId);
+  return Send(Message);
+}
+
+void GameServerRelay::SendState()
+{
+  /* The observers waiting for the game get the data and the moves made since */
+  vector<GameServerClient*>::iterator it;
+  for (it = Room->Observers.begin(); it != Room->Observers.end(); it++)
+  {
+    if (!(*it)->Synchronised)
+    {
+      (*it)->Send(Room->GameData);
+      vector<GameServerMessage>::iterator it2;
+      for (it2 = Room->Journal.begin(); it2 != Room->Journal.end(); it2++)
+        (*it)->Send(*it2);
+    }
+    (*it)->Synchronised = true;
+  }
+}
+
+void GameServerRelay::Run(Thread* Owner)
+{
+  /* Connect to the upstream server like a client and subscribe to the room */
+  if (Open() && Owner->IsActive())
+  {
+    string Str;
+    long Version = (ReceiveString(Str) ? ReceiveInteger() : -1);
+
+    /* The relay decodes the fixed width protocol, it announces an older version */
+    GameServerMessage Message;
+    Message.AddString(GameServer::Id);
+    Message.AddInteger(GameServer::CompactVersion - 1);
+    if (Str == GameServer::Id && Version >= GameServer::SupportedVersion && Send(Message))
+    {
+      Server->LockRoom(Room);
+      Connected = true;
+      Requested = true;
+      Replaying = true;
+      Server->UnlockRoom(Room);
+
+      /* Forward the room's messages until it is closed, waking up regularly
+         to send the subscriptions requested meanwhile */
+      bool Active = SendRequest();
+      while (Active && Owner->IsActive())
+      {
+        if (InterlockedExchange(&RequestPending, 0) != 0 && !SendRequest())
+          break;
+        fd_set Readable;
+        FD_ZERO(&Readable);
+        FD_SET(Socket, &Readable);
+        timeval Timeout = {0, 100000};
+        int Result = select(0, &Readable, NULL, NULL, &Timeout);
+        Active = (Result != SOCKET_ERROR && (Result == 0 || ReceiveMessage()));
+      }
+    }
+  }
+
+  /* The upstream room was rejected or closed, the server tears the mirror
+     down. The lobby lock is polled since the server may be deleting the
+     room meanwhile. */
+  Server->LockRoom(Room);
+  Connected = false;
+  Server->UnlockRoom(Room);
+  while (Owner->IsActive())
+  {
+    if (Server->Lock(100))
+    {
+      Server->CloseMirror(Room);
+      Server->Unlock();
+      break;
+    }
+  }
+}
+
+// GameServerRelayThread -------------------------------------------------------
+
+GameServerRelayThread::GameServerRelayThread(GameServerRelay* Parent)
+{
+  Relay = Parent;
+  Resume();
+}
+
+unsigned int GameServerRelayThread::Run()
+{
+  Relay->Run(this);
+  return 0;
+}
@@ -0,0 +1,108 @@
+/*
+* GameServerRelay.h - Upstream connection of a room mirrored by a relay server.
+*
+* Copyright (C) 2007-2011 Marc-André Lamothe.
+*
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU Library General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, write to the Free Software
+* Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+*/
+#ifndef GAMESERVERRELAY_H_
+#define GAMESERVERRELAY_H_
+
+#include "gameserverdata.h"
+#include "gameservermessage.h"
+#include "system.h"
+#include <stdlib.h>
+#include <string>
+#include <thread.h>
+#include <vector>
+
+using namespace std;
+
+struct GameServerRoom;
+
+class GameServer; /* because of circular reference */
+class GameServerClient;
+class GameServerRelayThread;
+
+/* A relay server serves the observers of rooms hosted by an upstream server.
+ * Each mirrored room has a single connection to the upstream server, which
+ * sends it the room's broadcasts once whatever the number of observers on
+ * the relay. The relay forwards them to its own observers and keeps the
+ * room's players and game data so that it can bring new observers up to
+ * date by itself. The game data and moves replayed when subscribing are
+ * held until the end of the replay, then sent to the observers waiting for
+ * them only. The mirror's state is guarded by the room's lock, the socket is
+ * made with the mirror, then only used by the relay's thread and never under
+ * a lock. The mirror is torn
+ * down when the upstream server rejects or closes the room. */
+class GameServerRelay
+{
+public:
+  unsigned int RoomId; /* On the upstream server */
+
+  GameServerRelay(GameServer* Parent, GameServerRoom* Mirror, const string& Address, unsigned int UpstreamId);
+  ~GameServerRelay();
+
+  unsigned int GetMemberCount();
+  void RequestState();
+  void SendMembers(GameServerClient* Client);
+
+private:
+  struct Member
+  {
+    unsigned int Id;
+    string Name;
+    PlayerType Type;
+  };
+
+  GameServer* Server;
+  GameServerRoom* Room;
+  string Host;
+  int Port;
+  SOCKET Socket;
+  GameServerRelayThread* RelayThread;
+  bool Connected;
+  bool Requested; /* Waiting for the room's game data */
+  bool Replaying; /* Receiving the room's state, up to its end mark */
+  volatile LONG RequestPending; /* A subscription the thread has to send */
+  vector<Member> Members;
+
+  vector<Member>::iterator FindMember(unsigned int Id);
+  bool Open();
+  bool Receive(void* Data, unsigned long DataSize);
+  long ReceiveInteger();
+  bool ReceiveMessage();
+  bool ReceiveString(string& Value);
+  bool Send(const GameServerMessage& Message);
+  bool SendRequest();
+  void SendState();
+  void Run(Thread* Owner);
+
+  friend class GameServerRelayThread;
+};
+
+/* Thread that reads the mirrored room's messages from the upstream server */
+class GameServerRelayThread : public Thread
+{
+public:
+  GameServerRelayThread(GameServerRelay* Parent);
+
+private:
+  GameServerRelay* Relay;
+
+  unsigned int Run();
+};
+
+#endif
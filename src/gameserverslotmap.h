@@ -0,0 +1,141 @@
+/*
+* GameServerSlotMap.h - Generational slot map that stores the server's objects.
+*
+* Copyright (C) 2007-2011 Marc-André Lamothe.
+*
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU Library General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, write to the Free Software
+* Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+*/
+#ifndef GAMESERVERSLOTMAP_H_
+#define GAMESERVERSLOTMAP_H_
+
+#include <cstddef>
+#include <vector>
+
+using namespace std;
+
+/* Values are kept contiguous so that they can be iterated like an array,
+ * removing one moves the last value in its place. Each value is reached in
+ * constant time through a 32 bits handle made of its 20 bits slot index and
+ * of the slot's 11 bits generation, which changes every time the slot is
+ * reused so that a stale handle is never mistaken for a newer value. A free
+ * slot answers to no handle. Handles are never 0. The top bit of the handles
+ * is set for tagged maps, the handles of a tagged and of an untagged map
+ * never collide. */
+template <class T> class GameServerSlotMap
+{
+public:
+  static const unsigned int IndexBits = 20;
+  static const unsigned int MaxSize = (1 << IndexBits) - 1;
+  static const unsigned int TagBit = 0x80000000;
+
+  GameServerSlotMap(bool Tagged = false)
+  {
+    FreeSlot = 0;
+    Tag = (Tagged ? TagBit : 0);
+  }
+
+  T& operator[](const unsigned int Position)
+  {
+    return Values[Position];
+  }
+
+  void Clear()
+  {
+    Values.clear();
+    Handles.clear();
+    Slots.clear();
+    FreeSlot = 0;
+  }
+
+  T* Find(const unsigned int Handle)
+  {
+    unsigned int Index = Handle & MaxSize;
+    if (Handle == 0 || Index == 0 || Index > Slots.size() || Slots[Index-1].Free || Slots[Index-1].Handle != Handle)
+      return NULL;
+    return &Values[Slots[Index-1].Position];
+  }
+
+  unsigned int Insert(const T& Value)
+  {
+    unsigned int Index;
+    if (FreeSlot != 0)
+    {
+      /* Reuse a slot with the next generation, skipping 0 so that handles are never 0 */
+      Index = FreeSlot;
+      FreeSlot = Slots[Index-1].Position;
+      unsigned int Generation = ((Slots[Index-1].Handle & ~TagBit) >> IndexBits) + 1;
+      if (((Generation << IndexBits) & TagBit) != 0)
+        Generation = 1;
+      Slots[Index-1].Handle = Tag | (Generation << IndexBits) | Index;
+      Slots[Index-1].Free = false;
+    }
+    else
+    {
+      if (Slots.size() >= MaxSize)
+        return 0;
+      Slot NewSlot;
+      NewSlot.Handle = Tag | (1 << IndexBits) | (Slots.size()+1);
+      NewSlot.Free = false;
+      Slots.push_back(NewSlot);
+      Index = Slots.size();
+    }
+    Slots[Index-1].Position = Values.size();
+    Values.push_back(Value);
+    Handles.push_back(Slots[Index-1].Handle);
+    return Slots[Index-1].Handle;
+  }
+
+  bool Remove(const unsigned int Handle)
+  {
+    if (Find(Handle) == NULL)
+      return false;
+    unsigned int Index = Handle & MaxSize;
+    unsigned int Position = Slots[Index-1].Position;
+
+    /* Move the last value in the hole */
+    Values[Position] = Values.back();
+    Handles[Position] = Handles.back();
+    Slots[(Handles[Position] & MaxSize)-1].Position = Position;
+    Values.pop_back();
+    Handles.pop_back();
+
+    /* The slot keeps its handle until it is reused */
+    Slots[Index-1].Free = true;
+    Slots[Index-1].Position = FreeSlot;
+    FreeSlot = Index;
+    return true;
+  }
+
+  unsigned int Size() const
+  {
+    return Values.size();
+  }
+
+private:
+  struct Slot
+  {
+    unsigned int Handle;    /* Current or last handle of the slot */
+    unsigned int Position;  /* Position of the value, or next free slot */
+    bool Free;
+  };
+
+  vector<T> Values;
+  vector<unsigned int> Handles;  /* Handle of each value, by position */
+  vector<Slot> Slots;
+  unsigned int FreeSlot;         /* Index + 1 of the first free slot, 0 if none */
+  unsigned int Tag;
+};
+
+#endif
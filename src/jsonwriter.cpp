@@ -0,0 +1,177 @@
+/*
+* JSONWriter.cpp - Streaming writer of the web interface's JSON documents.
+*
+* Copyright (C) 2007-2011 Marc-André Lamothe.
+*
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU Library General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, write to the Free Software
+* Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+*/
+#include "jsonwriter.h"
+
+// Public functions ------------------------------------------------------------
+
+JSONWriter::JSONWriter(string& Buffer) : Output(Buffer)
+{
+  Depth = 0;
+  Empty[0] = true;
+  Keyed = false;
+}
+
+void JSONWriter::AddBoolean(const bool Value)
+{
+  Separate();
+  Output.append(Value ? "true" : "false");
+}
+
+void JSONWriter::AddInteger(const long Value)
+{
+  Separate();
+  if (Value < 0)
+    AppendInteger(-(unsigned long)Value, true);
+  else
+    AppendInteger(Value, false);
+}
+
+void JSONWriter::AddKey(const char* Name)
+{
+  Separate();
+  Output += '"';
+  Output.append(Name);
+  Output.append("\":");
+  Keyed = true;
+}
+
+void JSONWriter::AddQuotedInteger(const long Value)
+{
+  Separate();
+  Output += '"';
+  if (Value < 0)
+    AppendInteger(-(unsigned long)Value, true);
+  else
+    AppendInteger(Value, false);
+  Output += '"';
+}
+
+void JSONWriter::AddQuotedUnsigned(const unsigned long Value)
+{
+  Separate();
+  Output += '"';
+  AppendInteger(Value, false);
+  Output += '"';
+}
+
+void JSONWriter::AddString(const char* Value, const unsigned long Length)
+{
+  static const char Digits[] = "0123456789abcdef";
+  Separate();
+  Output += '"';
+
+  /* Copy the runs of characters that need no escaping at once */
+  unsigned long Start = 0;
+  for (unsigned long i = 0; i < Length; i++)
+  {
+    unsigned char Character = Value[i];
+    if (Character >= 0x20 && Character < 0x7F && Character != '"' && Character != '\\')
+      continue;
+    Output.append(Value + Start, i - Start);
+    Start = i + 1;
+    if (Character == '"' || Character == '\\')
+    {
+      Output += '\\';
+      Output += Character;
+    }
+    else if (Character == '\n')
+      Output.append("\\n");
+    else if (Character == '\r')
+      Output.append("\\r");
+    else if (Character == '\t')
+      Output.append("\\t");
+    else
+    {
+      char Escape[] = {'\\', 'u', '0', '0', Digits[Character >> 4], Digits[Character & 0xF]};
+      Output.append(Escape, sizeof(Escape));
+    }
+  }
+  Output.append(Value + Start, Length - Start);
+  Output += '"';
+}
+
+void JSONWriter::AddString(const string& Value)
+{
+  AddString(Value.data(), Value.size());
+}
+
+void JSONWriter::AddUnsigned(const unsigned long Value)
+{
+  Separate();
+  AppendInteger(Value, false);
+}
+
+void JSONWriter::BeginArray()
+{
+  Separate();
+  Output += '[';
+  if (Depth + 1 < MaxDepth)
+    Empty[++Depth] = true;
+}
+
+void JSONWriter::BeginObject()
+{
+  Separate();
+  Output += '{';
+  if (Depth + 1 < MaxDepth)
+    Empty[++Depth] = true;
+}
+
+void JSONWriter::EndArray()
+{
+  Output += ']';
+  if (Depth > 0)
+    Depth--;
+}
+
+void JSONWriter::EndObject()
+{
+  Output += '}';
+  if (Depth > 0)
+    Depth--;
+}
+
+// Private functions -----------------------------------------------------------
+
+void JSONWriter::AppendInteger(unsigned long Value, bool Negative)
+{
+  /* The digits are written from the last one in a buffer large enough for 64 bits */
+  char Buffer[21];
+  char* Digit = Buffer + sizeof(Buffer);
+  do
+  {
+    *--Digit = (char)('0' + Value % 10);
+    Value /= 10;
+  }
+  while (Value > 0);
+  if (Negative)
+    *--Digit = '-';
+  Output.append(Digit, Buffer + sizeof(Buffer) - Digit);
+}
+
+void JSONWriter::Separate()
+{
+  /* A value following a key or starting a list isn't separated */
+  if (Keyed)
+    Keyed = false;
+  else if (!Empty[Depth])
+    Output += ',';
+  Empty[Depth] = false;
+}
@@ -0,0 +1,61 @@
+/*
+* JSONWriter.h - Streaming writer of the web interface's JSON documents.
+*
+* Copyright (C) 2007-2011 Marc-André Lamothe.
+*
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU Library General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, write to the Free Software
+* Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+*/
+#ifndef JSONWRITER_H_
+#define JSONWRITER_H_
+
+#include <string>
+
+using namespace std;
+
+/* Appends a JSON document to a string, the separators being added as the
+ * values are. Numbers are formatted in place and strings are escaped, the
+ * bytes above 127 being taken as Latin-1 characters. Nothing is allocated
+ * besides the output, which the caller can reserve and reuse. */
+class JSONWriter
+{
+public:
+  static const unsigned int MaxDepth = 16;
+
+  JSONWriter(string& Buffer);
+
+  void AddBoolean(const bool Value);
+  void AddInteger(const long Value);
+  void AddKey(const char* Name);
+  void AddQuotedInteger(const long Value);
+  void AddQuotedUnsigned(const unsigned long Value);
+  void AddString(const char* Value, const unsigned long Length);
+  void AddString(const string& Value);
+  void AddUnsigned(const unsigned long Value);
+  void BeginArray();
+  void BeginObject();
+  void EndArray();
+  void EndObject();
+
+private:
+  string& Output;
+  unsigned int Depth;
+  bool Empty[MaxDepth];  /* No value added yet at each level */
+  bool Keyed;            /* A key waits for its value */
+
+  void AppendInteger(unsigned long Value, bool Negative);
+  void Separate();
+};
+
+#endif
@@ -21,6 +21,7 @@
 #define SYSTEM_H_
 
 #define _WIN32_WINNT 0x0501
+#include <winsock2.h>
 #include <windows.h>
 
 #endif
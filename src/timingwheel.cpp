@@ -0,0 +1,126 @@
+/*
+* TimingWheel.cpp - Hierarchical timing wheel used for the server's deadlines.
+*
+* Copyright (C) 2007-2011 Marc-André Lamothe.
+*
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU Library General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, write to the Free Software
+* Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+*/
+#include "timingwheel.h"
+
+// Public functions ------------------------------------------------------------
+
+TimingWheel::TimingWheel(unsigned long Tick)
+{
+  CurrentTick = Tick;
+  for (unsigned int i = 0; i < Levels; i++)
+    for (unsigned int j = 0; j < SlotCount; j++)
+      Slots[i][j] = NULL;
+}
+
+void TimingWheel::Advance(unsigned long Tick, vector<TimingWheelTimer*>& Expired)
+{
+  while ((long)(Tick - CurrentTick) > 0)
+  {
+    CurrentTick++;
+
+    /* Move the timers of the next slot of each upper level down, each time
+       the level below it has gone around */
+    for (unsigned int Level = 1; Level < Levels; Level++)
+    {
+      if (((CurrentTick >> ((Level-1)*SlotBits)) & (SlotCount-1)) != 0)
+        break;
+      TimingWheelTimer** Slot = &Slots[Level][(CurrentTick >> (Level*SlotBits)) & (SlotCount-1)];
+      TimingWheelTimer* Timer = *Slot;
+      *Slot = NULL;
+      while (Timer != NULL)
+      {
+        TimingWheelTimer* Next = Timer->Next;
+        Insert(Timer);
+        Timer = Next;
+      }
+    }
+
+    /* Expire the timers of the current slot */
+    TimingWheelTimer** Slot = &Slots[0][CurrentTick & (SlotCount-1)];
+    TimingWheelTimer* Timer = *Slot;
+    *Slot = NULL;
+    while (Timer != NULL)
+    {
+      TimingWheelTimer* Next = Timer->Next;
+      Timer->Slot = NULL;
+      Expired.push_back(Timer);
+      Timer = Next;
+    }
+  }
+}
+
+void TimingWheel::Cancel(TimingWheelTimer* Timer)
+{
+  if (Timer->Slot == NULL)
+    return;
+  if (Timer->Previous != NULL)
+    Timer->Previous->Next = Timer->Next;
+  else
+    *Timer->Slot = Timer->Next;
+  if (Timer->Next != NULL)
+    Timer->Next->Previous = Timer->Previous;
+  Timer->Slot = NULL;
+}
+
+unsigned long TimingWheel::GetTick() const
+{
+  return CurrentTick;
+}
+
+void TimingWheel::Initialise(TimingWheelTimer* Timer)
+{
+  Timer->Next = NULL;
+  Timer->Previous = NULL;
+  Timer->Slot = NULL;
+  Timer->Expiry = 0;
+  Timer->Type = 0;
+  Timer->Id = 0;
+}
+
+void TimingWheel::Schedule(TimingWheelTimer* Timer, unsigned long Expiry)
+{
+  /* The current tick was already expired, timers already due expire on the next one */
+  Cancel(Timer);
+  Timer->Expiry = ((long)(Expiry - CurrentTick) > 0 ? Expiry : CurrentTick + 1);
+  Insert(Timer);
+}
+
+// Private functions -----------------------------------------------------------
+
+void TimingWheel::Insert(TimingWheelTimer* Timer)
+{
+  /* Timers beyond the span of the wheel wait in the last level and come back
+     down from there */
+  unsigned long Ticks = Timer->Expiry - CurrentTick;
+  unsigned int Level = 0;
+  while (Level < Levels-1 && Ticks >= ((unsigned long)1 << ((Level+1)*SlotBits)))
+    Level++;
+  unsigned long Expiry = Timer->Expiry;
+  if (Level == Levels-1 && Ticks >= ((unsigned long)1 << (Levels*SlotBits)))
+    Expiry = CurrentTick + ((unsigned long)1 << (Levels*SlotBits)) - 1;
+
+  TimingWheelTimer** Slot = &Slots[Level][(Expiry >> (Level*SlotBits)) & (SlotCount-1)];
+  Timer->Slot = Slot;
+  Timer->Previous = NULL;
+  Timer->Next = *Slot;
+  if (*Slot != NULL)
+    (*Slot)->Previous = Timer;
+  *Slot = Timer;
+}
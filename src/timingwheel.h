@@ -0,0 +1,64 @@
+/*
+* TimingWheel.h - Hierarchical timing wheel used for the server's deadlines.
+*
+* Copyright (C) 2007-2011 Marc-André Lamothe.
+*
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU Library General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, write to the Free Software
+* Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+*/
+#ifndef TIMINGWHEEL_H_
+#define TIMINGWHEEL_H_
+
+#include <stddef.h>
+#include <vector>
+
+using namespace std;
+
+struct TimingWheelTimer
+{
+  TimingWheelTimer* Next;
+  TimingWheelTimer* Previous;
+  TimingWheelTimer** Slot;  /* List the timer is in, NULL when not scheduled */
+  unsigned long Expiry;     /* In ticks */
+  unsigned int Type;        /* What the timer is for */
+  unsigned int Id;          /* Which client or room it is for */
+};
+
+/* Timers are kept in lists by expiry, each level covering 64 times the span
+ * of the previous one. Scheduling and cancelling are constant time, timers
+ * move down one level at a time as their expiry gets closer. The wheel isn't
+ * thread safe, the owner must lock it. */
+class TimingWheel
+{
+public:
+  static const unsigned int Levels = 4;
+  static const unsigned int SlotBits = 6;
+  static const unsigned int SlotCount = 1 << SlotBits;
+
+  TimingWheel(unsigned long Tick);
+
+  void Advance(unsigned long Tick, vector<TimingWheelTimer*>& Expired);
+  void Cancel(TimingWheelTimer* Timer);
+  unsigned long GetTick() const;
+  static void Initialise(TimingWheelTimer* Timer);
+  void Schedule(TimingWheelTimer* Timer, unsigned long Expiry);
+
+private:
+  TimingWheelTimer* Slots[Levels][SlotCount];
+  unsigned long CurrentTick;
+
+  void Insert(TimingWheelTimer* Timer);
+};
+
+#endif
@@ -0,0 +1,45 @@
+/*
+* Bench.h - Timing shared by the benchmarks.
+*
+* Copyright (C) 2007-2011 Marc-André Lamothe.
+*
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU Library General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, write to the Free Software
+* Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+*/
+#ifndef BENCH_H_
+#define BENCH_H_
+
+#include <stdio.h>
+#include <time.h>
+
+/* Processor time in seconds, each benchmark repeats what it times for a
+   good fraction of a second so that the clock's resolution doesn't matter */
+static inline double Seconds()
+{
+  return (double)clock() / CLOCKS_PER_SEC;
+}
+
+/* The same pseudo-random sequence on every run */
+static unsigned int Seed = 12345;
+
+static inline unsigned int Random()
+{
+  Seed = Seed * 1103515245 + 12345;
+  return Seed >> 8;
+}
+
+/* Keeps the compiler from dropping the work being timed */
+static volatile unsigned long Sink = 0;
+
+#endif
@@ -0,0 +1,46 @@
+/*
+* Check.h - Reporting shared by the checks.
+*
+* Copyright (C) 2007-2011 Marc-André Lamothe.
+*
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU Library General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, write to the Free Software
+* Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+*/
+#ifndef CHECK_H_
+#define CHECK_H_
+
+#include <stdio.h>
+
+/* Each check program is a single file, a failed check is reported and the
+   others still run */
+static int Failures = 0;
+
+static void Check(bool Condition, const char* Description)
+{
+  if (!Condition)
+  {
+    printf("FAILED: %s\n", Description);
+    Failures++;
+  }
+}
+
+/* The program's exit code */
+static int Report(const char* Name)
+{
+  if (Failures == 0)
+    printf("All %s checks passed\n", Name);
+  return (Failures == 0 ? 0 : 1);
+}
+
+#endif
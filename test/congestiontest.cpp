@@ -0,0 +1,58 @@
+/*
+* CongestionTest.cpp - Checks of the policy applied to congested outbound queues.
+*
+* Copyright (C) 2007-2011 Marc-André Lamothe.
+*
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU Library General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, write to the Free Software
+* Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+*/
+#include "../src/gameservercongestion.h"
+#include "check.h"
+
+int main()
+{
+  const unsigned long Congested = GameServerCongestion::CongestedQueueSize + 1;
+  const unsigned long Full = GameServerCongestion::MaxQueueSize;
+  const unsigned long PlayerFull = GameServerCongestion::MaxPlayerQueueSize;
+  const unsigned long Grace = GameServerCongestion::GracePeriod;
+
+  /* Below the congestion size everything is queued */
+  Check(GameServerCongestion::Admit(ND_Message, false, 0, 100, false, 0) == QueueMessage, "the chat is queued to an idle observer");
+  Check(GameServerCongestion::Admit(ND_PlayerTime, true, Congested - 1, 100, false, 0) == QueueMessage, "times aren't coalesced below the congestion size");
+
+  /* Congested observers lose the chat, the players keep it */
+  Check(GameServerCongestion::Admit(ND_Message, false, Congested, 100, false, 0) == DropMessage, "the chat is dropped for a congested observer");
+  Check(GameServerCongestion::Admit(ND_Message, true, Congested, 100, false, 0) == QueueMessage, "the chat is queued for a congested player");
+  Check(GameServerCongestion::Admit(ND_Move, false, Congested, 100, false, 0) == QueueMessage, "moves are never dropped");
+
+  /* Times and room states replace their queued copy, or are queued when there is none */
+  Check(GameServerCongestion::Admit(ND_PlayerTime, true, Congested, 100, false, 0) == CoalesceMessage, "a congested player's time is coalesced");
+  Check(GameServerCongestion::Admit(ND_RoomInfo, false, Congested, 100, false, 0) == CoalesceMessage, "a congested observer's room state is coalesced");
+  Check(GameServerCongestion::Admit(ND_PlayerTime, true, Congested, 100, false, 0, false) == QueueMessage, "a time without a queued copy is queued");
+
+  /* Observers are closed at the maximum size, players at their own */
+  Check(GameServerCongestion::Admit(ND_Move, false, Full - 100, 100, false, 0) == QueueMessage, "an observer's queue fills up to its maximum size");
+  Check(GameServerCongestion::Admit(ND_Move, false, Full - 100, 101, false, 0) == CloseClient, "an observer past the maximum size is closed");
+  Check(GameServerCongestion::Admit(ND_Move, true, Full, 100, true, 0) == QueueMessage, "a player past the maximum size keeps its seat");
+  Check(GameServerCongestion::Admit(ND_Move, true, PlayerFull - 100, 101, true, 0) == CloseClient, "a player past its own maximum size is closed");
+  Check(GameServerCongestion::Admit(ND_PlayerTime, true, PlayerFull, 100, true, 0, false) == CloseClient, "a time without a queued copy can overflow a player's queue");
+
+  /* The grace period of a stalled player */
+  Check(GameServerCongestion::Admit(ND_Move, true, Full, 100, true, Grace) == QueueMessage, "a stalled player keeps its seat during the grace period");
+  Check(GameServerCongestion::Admit(ND_Move, true, Full, 100, true, Grace + 1) == CloseClient, "a player still stalled after the grace period is closed");
+  Check(GameServerCongestion::Admit(ND_Move, true, Full, 100, false, Grace + 1) == QueueMessage, "a player that caught up has no deadline");
+  Check(!GameServerCongestion::Stalls(Full) && GameServerCongestion::Stalls(Full + 1), "a queue stalls past the maximum size");
+
+  return Report("congestion");
+}
@@ -0,0 +1,86 @@
+/*
+* FramingTest.cpp - Checks of the compact protocol's varint frames.
+*
+* Copyright (C) 2007-2011 Marc-André Lamothe.
+*
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU Library General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, write to the Free Software
+* Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+*/
+#include "../src/gameservermessage.h"
+#include "check.h"
+
+/* Reads a frame's length and checks that the frame follows it exactly */
+static bool ReadFrame(const string& Buffer, unsigned long& Position, string& Frame)
+{
+  unsigned long Length;
+  if (!GameServerMessage::ReadVarint(Buffer, Position, Length) || Buffer.size() - Position < Length)
+    return false;
+  Frame = Buffer.substr(Position, Length);
+  Position += Length;
+  return true;
+}
+
+int main()
+{
+  /* The varints are 7 bits groups, lowest first */
+  static const unsigned long Values[] = {0, 1, 127, 128, 300, 16383, 16384, 2097151, 2097152, 268435455, 268435456, 0xFFFFFFFFUL};
+  static const unsigned int Sizes[] = {1, 1, 1, 2, 2, 2, 3, 3, 4, 4, 5, 5};
+  const unsigned int Count = sizeof(Values) / sizeof(Values[0]);
+  GameServerMessage Message(ND_Move);
+  for (unsigned int i = 0; i < Count; i++)
+    Message.AddInteger((long)Values[i]);
+  unsigned long Position = 0;
+  string Frame;
+  Check(ReadFrame(Message.GetFrame(), Position, Frame) && Position == Message.GetFrame().size(), "a message is a single frame prefixed by its length");
+  unsigned long Value;
+  unsigned long FramePosition = 0;
+  Check(GameServerMessage::ReadVarint(Frame, FramePosition, Value) && Value == ND_Move, "a frame starts with the message's type");
+  bool Same = true;
+  for (unsigned int i = 0; i < Count && Same; i++)
+  {
+    unsigned long Start = FramePosition;
+    Same = (GameServerMessage::ReadVarint(Frame, FramePosition, Value) && Value == Values[i] && FramePosition - Start == Sizes[i]);
+  }
+  Check(Same && FramePosition == Frame.size(), "integers are read back with the least bytes");
+  Check(Message.GetData().size() == 4 * (Count + 1) && (unsigned char)Message.GetData()[3] == ND_Move && Message.GetData()[0] == 0, "the fixed width encoding is kept alongside");
+
+  /* A frame of 128 bytes or more has a longer length */
+  GameServerMessage Chat(ND_Message);
+  Chat.AddInteger(7);
+  Chat.AddString(string(200, 'x'));
+  Position = 0;
+  Check(ReadFrame(Chat.GetFrame(), Position, Frame) && Frame.size() == 1 + 1 + 2 + 200 && Chat.GetFrame().size() == 2 + Frame.size(), "long frames have a two bytes length");
+  FramePosition = 2;
+  Check(GameServerMessage::ReadVarint(Frame, FramePosition, Value) && Value == 200 && Frame.compare(FramePosition, string::npos, string(200, 'x')) == 0, "strings are prefixed by their length");
+
+  /* A batch holds the frames of its messages */
+  GameServerMessage Batch;
+  Batch.Append(Message);
+  Batch.Append(Chat);
+  Check(Batch.GetFrame() == Message.GetFrame() + Chat.GetFrame(), "a batch is its messages' frames");
+  Check(Batch.GetData() == Message.GetData() + Chat.GetData(), "a batch is its messages' fixed width encodings");
+
+  /* Truncated and overlong varints are rejected */
+  string Truncated("\x80\x80", 2);
+  Position = 0;
+  Check(!GameServerMessage::ReadVarint(Truncated, Position, Value), "a truncated varint is rejected");
+  string Overlong("\x80\x80\x80\x80\x80\x01", 6);
+  Position = 0;
+  Check(!GameServerMessage::ReadVarint(Overlong, Position, Value), "a varint longer than 5 bytes is rejected");
+  string Short("\x05\x01", 2);
+  Position = 0;
+  Check(!ReadFrame(Short, Position, Frame), "a frame shorter than its length is rejected");
+
+  return Report("framing");
+}
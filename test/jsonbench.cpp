@@ -0,0 +1,122 @@
+/*
+* JSONBench.cpp - Benchmark of the admin pages' JSON documents.
+*
+* Copyright (C) 2007-2011 Marc-André Lamothe.
+*
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU Library General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, write to the Free Software
+* Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+*/
+#include "../src/jsonwriter.h"
+#include "bench.h"
+#include <vector>
+
+/* The fields of a player as listed by the admin page */
+struct Player
+{
+  unsigned int Id;
+  string Name;
+  long Version;
+  long ConnectionTime;
+  unsigned int RoomId;
+  long Type;
+  bool Ready;
+};
+
+/* A number formatted into a buffer of its own, as the documents were
+   concatenated before the writer */
+static char* Format(long Value)
+{
+  char* Result = new char[12];
+  sprintf(Result, "%ld", Value);
+  return Result;
+}
+
+int main()
+{
+  const unsigned int Players = 50000;
+  vector<Player> List(Players);
+  for (unsigned int i = 0; i < Players; i++)
+  {
+    char Name[32];
+    sprintf(Name, "Player %u", Random() % 100000);
+    List[i].Id = 4000000000U - i;
+    List[i].Name = Name;
+    List[i].Version = 510;
+    List[i].ConnectionTime = Random() % 86400;
+    List[i].RoomId = Random() % 20000;
+    List[i].Type = Random() % 3;
+    List[i].Ready = (Random() % 2 == 0);
+  }
+
+  /* The players' list, written the way GetJSONPlayers does */
+  const unsigned int Documents = 50;
+  string Result;
+  double Start = Seconds();
+  for (unsigned int i = 0; i < Documents; i++)
+  {
+    Result.clear();
+    Result.reserve(Players * 64);
+    JSONWriter Writer(Result);
+    Writer.BeginArray();
+    for (unsigned int j = 0; j < Players; j++)
+    {
+      Writer.BeginArray();
+      Writer.AddQuotedUnsigned(List[j].Id);
+      Writer.AddString(List[j].Name);
+      Writer.AddQuotedInteger(List[j].Version);
+      Writer.AddQuotedInteger(List[j].ConnectionTime);
+      Writer.AddQuotedUnsigned(List[j].RoomId);
+      Writer.AddQuotedInteger(List[j].Type);
+      Writer.AddString(List[j].Ready ? "1" : "0");
+      Writer.EndArray();
+    }
+    Writer.EndArray();
+    Sink += Result.size();
+  }
+  double Written = (Seconds() - Start) / Documents;
+  unsigned long Size = Result.size();
+
+  /* The same list concatenated, without escaping the names */
+  Start = Seconds();
+  for (unsigned int i = 0; i < Documents; i++)
+  {
+    string Concatenated = "[";
+    for (unsigned int j = 0; j < Players; j++)
+    {
+      if (j > 0)
+        Concatenated += ",";
+      const long Values[] = {(long)List[j].Id, List[j].Version, List[j].ConnectionTime, (long)List[j].RoomId, List[j].Type};
+      Concatenated += "[\"";
+      for (unsigned int k = 0; k < 5; k++)
+      {
+        char* Str = Format(Values[k]);
+        Concatenated += Str;
+        delete[] Str;
+        Concatenated += "\",\"";
+        if (k == 0)
+        {
+          Concatenated += List[j].Name;
+          Concatenated += "\",\"";
+        }
+      }
+      Concatenated += (List[j].Ready ? "1" : "0");
+      Concatenated += "\"]";
+    }
+    Concatenated += "]";
+    Sink += Concatenated.size();
+  }
+  double Concatenated = (Seconds() - Start) / Documents;
+  printf("List of %u players, %lu bytes: %.1f ms written, %.0f MB/s, %.1f ms concatenated\n", Players, Size, Written * 1000, Size / Written / 1e6, Concatenated * 1000);
+  return 0;
+}
@@ -0,0 +1,544 @@
+/*
+* LoadBench.cpp - Load benchmark of the game server in each of its modes.
+*
+* Copyright (C) 2007-2011 Marc-André Lamothe.
+*
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU Library General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, write to the Free Software
+* Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+*/
+#include "../src/gameserver.h"
+#include "../src/gameservermessage.h"
+#include <algorithm>
+#include <psapi.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* The server runs in this process, its clients connect through the loopback
+   interface and speak the compact protocol on blocking sockets. Each pair
+   of clients plays in its own room; the rooms are split between a driver
+   thread per processor, each making one move in all of its rooms before
+   waiting for them to be relayed.
+
+   The options select the server's mode like its own: -reactor, -shards,
+   -actors and -validatemoves. -processors=N runs the server and the drivers
+   on the first processors only, -admin reads the admin pages' data as often
+   as possible while the moves are relayed, -rooms=N and -moves=N size the
+   run. -observers=N has N observers watch the first room, connected to the
+   server itself and then to a relay server run in this process as well. */
+
+static const int BenchPort = 2590;
+static const unsigned long GameDataSize = 4096;
+
+/* A knight going back and forth on each side, legal for as long as needed */
+static const unsigned long Moves[4] = {6 | (21 << 8), 62 | (45 << 8), 21 | (6 << 8), 45 | (62 << 8)};
+
+static LARGE_INTEGER Frequency;
+
+static double Elapsed(const LARGE_INTEGER& Start)
+{
+  /* In microseconds */
+  LARGE_INTEGER Now;
+  QueryPerformanceCounter(&Now);
+  return (double)(Now.QuadPart - Start.QuadPart) * 1000000.0 / Frequency.QuadPart;
+}
+
+static unsigned long Field(const string& Fields, unsigned int Index)
+{
+  unsigned long Position = 0;
+  unsigned long Value = 0;
+  for (unsigned int i = 0; i <= Index; i++)
+    if (!GameServerMessage::ReadVarint(Fields, Position, Value))
+      return 0;
+  return Value;
+}
+
+class BenchClient
+{
+public:
+  unsigned long Received; /* Bytes */
+
+  BenchClient()
+  {
+    Received = 0;
+    Header = 0;
+    Socket = INVALID_SOCKET;
+  }
+
+  ~BenchClient()
+  {
+    if (Socket != INVALID_SOCKET)
+      closesocket(Socket);
+  }
+
+  bool Open(int Port = BenchPort)
+  {
+    /* The server may still be opening its socket */
+    sockaddr_in Address;
+    memset(&Address, 0, sizeof(Address));
+    Address.sin_family = AF_INET;
+    Address.sin_port = htons(Port);
+    Address.sin_addr.s_addr = inet_addr("127.0.0.1");
+    for (unsigned int i = 0; i < 50; i++)
+    {
+      Socket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+      if (Socket == INVALID_SOCKET)
+        return false;
+      if (connect(Socket, (sockaddr*)&Address, sizeof(Address)) != SOCKET_ERROR)
+        break;
+      closesocket(Socket);
+      Socket = INVALID_SOCKET;
+      Sleep(20);
+    }
+    if (Socket == INVALID_SOCKET)
+      return false;
+    BOOL NoDelay = TRUE;
+    setsockopt(Socket, IPPROTO_TCP, TCP_NODELAY, (const char*)&NoDelay, sizeof(NoDelay));
+
+    /* The server's version comes first, in the fixed width encoding */
+    Header = 2 * sizeof(u_long) + strlen(GameServer::Id);
+    GameServerMessage Version;
+    Version.AddString(GameServer::Id);
+    Version.AddInteger(GameServer::Version);
+    return SendData(Version.GetData());
+  }
+
+  void Drain()
+  {
+    /* Drop whatever was sent meanwhile */
+    string Fields;
+    while (Receive(0xFFFFFFFF, Fields, 0));
+  }
+
+  bool Receive(unsigned long Types, string& Fields, DWORD Timeout = 5000)
+  {
+    /* Skips the frames of any other type */
+    DWORD Start = GetTickCount();
+    while (true)
+    {
+      unsigned long Position = 0;
+      unsigned long Size;
+      while (GameServerMessage::ReadVarint(Buffer, Position, Size) && Buffer.size() - Position >= Size)
+      {
+        string Frame = Buffer.substr(Position, Size);
+        Buffer.erase(0, Position + Size);
+        Position = 0;
+        unsigned long FieldPosition = 0;
+        unsigned long Type;
+        if (GameServerMessage::ReadVarint(Frame, FieldPosition, Type) && Type < 32 && (Types & (1UL << Type)) != 0)
+        {
+          Fields = Frame.substr(FieldPosition);
+          return true;
+        }
+      }
+
+      DWORD Waited = GetTickCount() - Start;
+      if (Waited > Timeout)
+        return false;
+      fd_set Readable;
+      FD_ZERO(&Readable);
+      FD_SET(Socket, &Readable);
+      timeval Wait = {(long)((Timeout - Waited) / 1000), (long)((Timeout - Waited) % 1000) * 1000};
+      if (select(0, &Readable, NULL, NULL, &Wait) <= 0)
+        return false;
+      char Chunk[4096];
+      int Result = recv(Socket, Chunk, sizeof(Chunk), 0);
+      if (Result <= 0)
+        return false;
+      Received += Result;
+      Buffer.append(Chunk, Result);
+      if (Header > 0)
+      {
+        unsigned long Skipped = min(Header, (unsigned long)Buffer.size());
+        Buffer.erase(0, Skipped);
+        Header -= Skipped;
+      }
+    }
+  }
+
+  bool ReceiveNotification(NotificationType Notification)
+  {
+    string Fields;
+    while (Receive(1UL << ND_Notification, Fields))
+      if (Field(Fields, 0) == (unsigned long)Notification)
+        return true;
+    return false;
+  }
+
+  bool Send(const GameServerMessage& Message)
+  {
+    return SendData(Message.GetFrame());
+  }
+
+private:
+  SOCKET Socket;
+  string Buffer;
+  unsigned long Header; /* Bytes of the server's version left to skip */
+
+  bool SendData(const string& Data)
+  {
+    unsigned long Sent = 0;
+    while (Sent < Data.size())
+    {
+      int Result = send(Socket, Data.data() + Sent, Data.size() - Sent, 0);
+      if (Result == SOCKET_ERROR)
+        return false;
+      Sent += Result;
+    }
+    return true;
+  }
+};
+
+struct BenchRoom
+{
+  unsigned int Id;
+  BenchClient White;
+  BenchClient Black;
+  unsigned int MoveCount;
+};
+
+static bool Relay(BenchRoom& Room)
+{
+  /* One move, until both players got it */
+  BenchClient& Mover = (Room.MoveCount % 2 == 0 ? Room.White : Room.Black);
+  BenchClient& Opponent = (Room.MoveCount % 2 == 0 ? Room.Black : Room.White);
+  GameServerMessage Message(ND_Move);
+  Message.AddInteger(Moves[Room.MoveCount % 4]);
+  Room.MoveCount++;
+  string Fields;
+  return (Mover.Send(Message) && Opponent.Receive(1UL << ND_Move, Fields) && Mover.Receive(1UL << ND_Move, Fields));
+}
+
+struct BenchDriver
+{
+  vector<BenchRoom*> Rooms;
+  unsigned int MoveCount;
+  vector<double> Latencies;
+  bool Failed;
+};
+
+static DWORD WINAPI RunDriver(LPVOID Parameter)
+{
+  /* One move in every room of the driver, then the next one */
+  BenchDriver* Driver = (BenchDriver*)Parameter;
+  Driver->Latencies.reserve(Driver->Rooms.size() * Driver->MoveCount);
+  for (unsigned int i = 0; i < Driver->MoveCount && !Driver->Failed; i++)
+  {
+    vector<LARGE_INTEGER> Starts(Driver->Rooms.size());
+    for (unsigned int j = 0; j < Driver->Rooms.size(); j++)
+    {
+      BenchRoom* Room = Driver->Rooms[j];
+      GameServerMessage Message(ND_Move);
+      Message.AddInteger(Moves[Room->MoveCount % 4]);
+      QueryPerformanceCounter(&Starts[j]);
+      if (!(Room->MoveCount % 2 == 0 ? Room->White : Room->Black).Send(Message))
+        Driver->Failed = true;
+    }
+    for (unsigned int j = 0; j < Driver->Rooms.size() && !Driver->Failed; j++)
+    {
+      BenchRoom* Room = Driver->Rooms[j];
+      string Fields;
+      if (!(Room->MoveCount % 2 == 0 ? Room->Black : Room->White).Receive(1UL << ND_Move, Fields))
+        Driver->Failed = true;
+      Driver->Latencies.push_back(Elapsed(Starts[j]));
+      if (!(Room->MoveCount % 2 == 0 ? Room->White : Room->Black).Receive(1UL << ND_Move, Fields))
+        Driver->Failed = true;
+      Room->MoveCount++;
+    }
+  }
+  return 0;
+}
+
+struct BenchAdmin
+{
+  GameServer* Server;
+  volatile LONG Active;
+  unsigned long Polls;
+};
+
+static DWORD WINAPI RunAdmin(LPVOID Parameter)
+{
+  /* What the admin pages read, as often as possible */
+  BenchAdmin* Admin = (BenchAdmin*)Parameter;
+  while (Admin->Active)
+  {
+    GameServerSnapshot* Snapshot = Admin->Server->AcquireSnapshot();
+    Admin->Server->ReleaseSnapshot(Snapshot);
+    Admin->Server->GetMetrics();
+    Admin->Polls++;
+  }
+  return 0;
+}
+
+static SIZE_T PrivateBytes()
+{
+  PROCESS_MEMORY_COUNTERS Counters;
+  if (!GetProcessMemoryInfo(GetCurrentProcess(), &Counters, sizeof(Counters)))
+    return 0;
+  return Counters.PagefileUsage;
+}
+
+int main(int argc, char* argv[])
+{
+  bool Shards = false;
+  bool Reactor = false;
+  unsigned int Processors = GameServerReactor::GetProcessorCount();
+  bool Actors = false;
+  bool Validate = false;
+  bool Admin = false;
+  unsigned int RoomCount = 500;
+  unsigned int MoveCount = 200;
+  unsigned int ObserverCount = 0;
+  for (int i = 1; i < argc; i++)
+  {
+    if (strcmp(argv[i], "-shards") == 0)
+      Shards = true;
+    else if (strcmp(argv[i], "-reactor") == 0)
+      Reactor = true;
+    else if (strncmp(argv[i], "-processors=", 12) == 0)
+      Processors = atoi(argv[i] + 12);
+    else if (strcmp(argv[i], "-actors") == 0)
+      Actors = true;
+    else if (strcmp(argv[i], "-validatemoves") == 0)
+      Validate = true;
+    else if (strcmp(argv[i], "-admin") == 0)
+      Admin = true;
+    else if (strncmp(argv[i], "-rooms=", 7) == 0)
+      RoomCount = atoi(argv[i] + 7);
+    else if (strncmp(argv[i], "-moves=", 7) == 0)
+      MoveCount = atoi(argv[i] + 7);
+    else if (strncmp(argv[i], "-observers=", 11) == 0)
+      ObserverCount = atoi(argv[i] + 11);
+  }
+  if (Processors == 0 || Processors > GameServerReactor::GetProcessorCount() || RoomCount == 0)
+    return 1;
+
+  /* The scaling with the processors is measured on the first ones only */
+  if (Processors < GameServerReactor::GetProcessorCount())
+    SetProcessAffinityMask(GetCurrentProcess(), ((DWORD_PTR)1 << Processors) - 1);
+  unsigned int ReactorCount = (Shards ? Processors : (Reactor ? 1 : 0));
+  unsigned int ReactorThreads = (Shards ? 1 : (Reactor ? Processors : 0));
+  printf("%s%s%s%s, %u processors, %u rooms, %u moves each\n", (Shards ? "shards" : (Reactor ? "reactor" : "threads")), (Actors ? ", actors" : ""), (Validate ? ", validated moves" : ""), (Admin ? ", admin polling" : ""), Processors, RoomCount, MoveCount);
+
+  WSADATA WinsockData;
+  if (WSAStartup(MAKEWORD(2, 2), &WinsockData) != 0)
+    return 1;
+  QueryPerformanceFrequency(&Frequency);
+  SIZE_T Memory = PrivateBytes();
+  GameServer* Server = new GameServer(ReactorCount, ReactorThreads, Actors, Validate, false, "", BenchPort, "127.0.0.1");
+  vector<BenchRoom*> Rooms(RoomCount);
+  for (unsigned int i = 0; i < RoomCount; i++)
+  {
+    Rooms[i] = new BenchRoom;
+    Rooms[i]->MoveCount = 0;
+  }
+
+  /* Every client connects at once, like after a restart */
+  LARGE_INTEGER Start;
+  QueryPerformanceCounter(&Start);
+  bool Failed = false;
+  for (unsigned int i = 0; i < RoomCount && !Failed; i++)
+    Failed = (!Rooms[i]->White.Open() || !Rooms[i]->Black.Open());
+  string Fields;
+  for (unsigned int i = 0; i < RoomCount && !Failed; i++)
+    Failed = (!Rooms[i]->White.Receive(1UL << ND_PlayerId, Fields) || !Rooms[i]->Black.Receive(1UL << ND_PlayerId, Fields));
+  double Time = Elapsed(Start);
+  if (Failed)
+  {
+    printf("FAILED: the clients can't connect\n");
+    return 1;
+  }
+  printf("connections: %u in %.1f ms, %.0f per second, %lu at most in one accept batch\n", 2 * RoomCount, Time / 1000, 2 * RoomCount * 1000000.0 / Time, Server->GetMetrics().MaxAcceptBatch);
+  printf("memory: %lu bytes per connection, both ends included\n", (unsigned long)((PrivateBytes() - Memory) / (2 * RoomCount)));
+
+  /* Seat the players and start the games */
+  for (unsigned int i = 0; i < RoomCount && !Failed; i++)
+  {
+    BenchRoom* Room = Rooms[i];
+    char Name[32];
+    sprintf(Name, "Bench %u", i);
+    GameServerMessage Create(ND_CreateRoom);
+    Create.AddString(Name);
+    Failed = (!Room->White.Send(Create) || !Room->White.Receive(1UL << ND_RoomInfo, Fields));
+    Room->Id = Field(Fields, 0);
+    GameServerMessage Join(ND_JoinRoom);
+    Join.AddInteger(Room->Id);
+    GameServerMessage White(ND_ChangeType);
+    White.AddInteger(WhitePlayerType);
+    GameServerMessage Black(ND_ChangeType);
+    Black.AddInteger(BlackPlayerType);
+    GameServerMessage Ready(ND_Notification);
+    Ready.AddInteger(IAmReady);
+    Failed = Failed || !Room->Black.Send(Join) || !Room->Black.ReceiveNotification(JoinedRoom);
+    Failed = Failed || !Room->White.Send(White) || !Room->Black.Send(Black);
+    Failed = Failed || !Room->White.Send(Ready) || !Room->Black.Send(Ready);
+    Failed = Failed || !Room->White.ReceiveNotification(GameStarted) || !Room->Black.ReceiveNotification(GameStarted);
+  }
+  if (Failed)
+  {
+    printf("FAILED: the games can't start\n");
+    return 1;
+  }
+
+  /* Relay the moves from a driver per processor, polling the admin data meanwhile if asked */
+  BenchAdmin Poller;
+  Poller.Server = Server;
+  Poller.Active = 1;
+  Poller.Polls = 0;
+  HANDLE AdminThread = (Admin ? CreateThread(NULL, 0, RunAdmin, &Poller, 0, NULL) : NULL);
+  unsigned int DriverCount = min(Processors, RoomCount);
+  vector<BenchDriver> Drivers(DriverCount);
+  vector<HANDLE> Threads(DriverCount);
+  for (unsigned int i = 0; i < RoomCount; i++)
+    Drivers[i % DriverCount].Rooms.push_back(Rooms[i]);
+  QueryPerformanceCounter(&Start);
+  for (unsigned int i = 0; i < DriverCount; i++)
+  {
+    Drivers[i].MoveCount = MoveCount;
+    Drivers[i].Failed = false;
+    Threads[i] = CreateThread(NULL, 0, RunDriver, &Drivers[i], 0, NULL);
+  }
+  WaitForMultipleObjects(DriverCount, &Threads[0], TRUE, INFINITE);
+  Time = Elapsed(Start);
+  vector<double> Latencies;
+  for (unsigned int i = 0; i < DriverCount; i++)
+  {
+    CloseHandle(Threads[i]);
+    Failed = Failed || Drivers[i].Failed;
+    Latencies.insert(Latencies.end(), Drivers[i].Latencies.begin(), Drivers[i].Latencies.end());
+  }
+  if (AdminThread != NULL)
+  {
+    InterlockedExchange(&Poller.Active, 0);
+    WaitForSingleObject(AdminThread, INFINITE);
+    CloseHandle(AdminThread);
+  }
+  if (Failed || Latencies.empty())
+  {
+    printf("FAILED: the moves aren't relayed\n");
+    return 1;
+  }
+  sort(Latencies.begin(), Latencies.end());
+  printf("moves: %u relayed in %.1f ms, %.0f per second, %u drivers\n", (unsigned int)Latencies.size(), Time / 1000, Latencies.size() * 1000000.0 / Time, DriverCount);
+  printf("move latency: %.0f us median, %.0f us at the 99th percentile, %.0f us at most\n", Latencies[Latencies.size() / 2], Latencies[Latencies.size() * 99 / 100], Latencies.back());
+  if (Admin)
+    printf("admin polls: %lu, %.0f per second\n", Poller.Polls, Poller.Polls * 1000000.0 / Time);
+
+  /* An observer joins each room twice: first the owner is asked for the
+     game, then it comes from the cache. Between the second and third joins
+     the players make moves, journaled after the cached game. */
+  const unsigned int JournalMoves = 20;
+  double MissTime = 0;
+  double HitTime = 0;
+  unsigned long CatchUpBytes = 0;
+  string GameData(GameDataSize, 'x');
+  for (unsigned int i = 0; i < RoomCount && !Failed; i++)
+  {
+    BenchRoom* Room = Rooms[i];
+    BenchClient Observer;
+    Failed = !Observer.Open() || !Observer.Receive(1UL << ND_PlayerId, Fields);
+    Room->White.Drain();
+    GameServerMessage Join(ND_JoinRoom);
+    Join.AddInteger(Room->Id);
+    GameServerMessage Leave(ND_LeaveRoom);
+    GameServerMessage Data(ND_GameData);
+    Data.AddInteger(GameData.size());
+    Data.AddBytes(GameData.data(), GameData.size());
+    const unsigned long GameDataTypes = (1UL << ND_GameData) | (1UL << ND_CompressedGameData);
+
+    QueryPerformanceCounter(&Start);
+    Failed = Failed || !Observer.Send(Join) || !Room->White.Receive(1UL << ND_NetworkRequest, Fields) || !Room->White.Send(Data) || !Observer.Receive(GameDataTypes, Fields);
+    MissTime += Elapsed(Start);
+    Failed = Failed || !Observer.Send(Leave) || !Observer.ReceiveNotification(LeftRoom);
+
+    QueryPerformanceCounter(&Start);
+    Failed = Failed || !Observer.Send(Join) || !Observer.Receive(GameDataTypes, Fields);
+    HitTime += Elapsed(Start);
+    Failed = Failed || !Observer.Send(Leave) || !Observer.ReceiveNotification(LeftRoom);
+
+    for (unsigned int j = 0; j < JournalMoves && !Failed; j++)
+      Failed = !Relay(*Room);
+    Observer.Drain();
+    unsigned long Received = Observer.Received;
+    Failed = Failed || !Observer.Send(Join) || !Observer.Receive(GameDataTypes, Fields);
+    for (unsigned int j = 0; j < JournalMoves && !Failed; j++)
+      Failed = !Observer.Receive(1UL << ND_Move, Fields);
+    CatchUpBytes += Observer.Received - Received;
+  }
+  if (Failed)
+  {
+    printf("FAILED: the observers can't join\n");
+    return 1;
+  }
+  printf("joins: %.0f us asking the owner, %.0f us from the cache\n", MissTime / RoomCount, HitTime / RoomCount);
+  printf("catch-up: %lu bytes for a %lu bytes game and %u moves, the room's players included\n", CatchUpBytes / RoomCount, GameDataSize, JournalMoves);
+
+  /* The observers of the first room watch it from the server, then from a
+     relay. The count of moves sent is shared by both servers, the relay
+     sending one to each of its observers, the rest is what the server sent. */
+  if (ObserverCount > 0)
+  {
+    char Upstream[32];
+    sprintf(Upstream, "127.0.0.1:%d", BenchPort);
+    GameServer* RelayServer = new GameServer(ReactorCount, ReactorThreads, false, false, false, Upstream, BenchPort + 1);
+    const unsigned int FanOutMoves = 50;
+    for (unsigned int Relayed = 0; Relayed < 2 && !Failed; Relayed++)
+    {
+      vector<BenchClient*> Observers(ObserverCount);
+      GameServerMessage Join(ND_JoinRoom);
+      Join.AddInteger(Rooms[0]->Id);
+      for (unsigned int i = 0; i < ObserverCount; i++)
+        Observers[i] = new BenchClient;
+      for (unsigned int i = 0; i < ObserverCount && !Failed; i++)
+        Failed = !Observers[i]->Open(Relayed ? BenchPort + 1 : BenchPort) || !Observers[i]->Receive(1UL << ND_PlayerId, Fields) || !Observers[i]->Send(Join) || !Observers[i]->ReceiveNotification(JoinedRoom);
+
+      /* A first move tells that every observer is followed */
+      Failed = Failed || !Relay(*Rooms[0]);
+      for (unsigned int i = 0; i < ObserverCount && !Failed; i++)
+      {
+        Failed = !Observers[i]->Receive(1UL << ND_Move, Fields);
+        Observers[i]->Drain();
+      }
+
+      unsigned long Sent = Server->GetMetrics().SentMessages[ND_Move];
+      QueryPerformanceCounter(&Start);
+      for (unsigned int i = 0; i < FanOutMoves && !Failed; i++)
+      {
+        Failed = !Relay(*Rooms[0]);
+        for (unsigned int j = 0; j < ObserverCount && !Failed; j++)
+          Failed = !Observers[j]->Receive(1UL << ND_Move, Fields);
+      }
+      Time = Elapsed(Start);
+      Sent = Server->GetMetrics().SentMessages[ND_Move] - Sent - (Relayed ? FanOutMoves * ObserverCount : 0);
+      if (!Failed)
+        printf("fan-out %s: %u observers, %.0f us per move until all got it, %lu moves sent by the server per move\n", (Relayed ? "through a relay" : "from the server"), ObserverCount, Time / FanOutMoves, Sent / FanOutMoves);
+      for (unsigned int i = 0; i < ObserverCount; i++)
+        delete Observers[i];
+    }
+    delete RelayServer;
+    if (Failed)
+    {
+      printf("FAILED: the observers don't follow the room\n");
+      return 1;
+    }
+  }
+
+  GameServerMetrics Metrics = Server->GetMetrics();
+  printf("server: %lu moves rejected, %lu messages dropped, %lu lobby lock holds, %lu us at most\n", Metrics.RejectedMoves, Metrics.DroppedMessages, Metrics.LockCount, Metrics.MaxLockTime);
+  for (unsigned int i = 0; i < RoomCount; i++)
+    delete Rooms[i];
+  delete Server;
+  WSACleanup();
+  return 0;
+}
@@ -0,0 +1,136 @@
+/*
+* MessageBench.cpp - Benchmark of the messages' encodings, of their broadcast
+* and of the lobby's room list.
+*
+* Copyright (C) 2007-2011 Marc-André Lamothe.
+*
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU Library General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, write to the Free Software
+* Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+*/
+#include "../src/gameservermessage.h"
+#include "bench.h"
+#include <list>
+#include <string.h>
+#include <vector>
+
+/* A move as relayed to a room: the player's id and the move */
+static GameServerMessage MoveMessage(unsigned int Id, unsigned int Data)
+{
+  GameServerMessage Message(ND_Move);
+  Message.AddInteger(Id);
+  Message.AddInteger(Data);
+  return Message;
+}
+
+/* A room as listed in the lobby */
+static GameServerMessage RoomMessage(unsigned int Id)
+{
+  GameServerMessage Message(ND_RoomInfo);
+  Message.AddInteger(Id);
+  Message.AddString("Room of a player");
+  Message.AddInteger(0);
+  Message.AddInteger(2 + Id % 5);
+  return Message;
+}
+
+int main()
+{
+  /* Encoding, both encodings are built for every message */
+  const unsigned long Messages = 1000000;
+  double Start = Seconds();
+  for (unsigned long i = 0; i < Messages; i++)
+    Sink += MoveMessage(i, 12 | 28 << 8).GetFrame().size();
+  double Elapsed = Seconds() - Start;
+  GameServerMessage Move = MoveMessage(1234, 12 | 28 << 8);
+  printf("Encoding a move: %.0f ns, %u bytes fixed width, %u bytes compact\n", Elapsed * 1e9 / Messages, (unsigned int)Move.GetData().size(), (unsigned int)Move.GetFrame().size());
+
+  /* Decoding, the way the client reads either encoding */
+  const string& Data = Move.GetData();
+  Start = Seconds();
+  for (unsigned long i = 0; i < Messages; i++)
+    for (unsigned long Position = 0; Position < Data.size(); Position += 4)
+    {
+      u_long Value;
+      memcpy(&Value, Data.data() + Position, 4);
+      Sink += ntohl(Value);
+    }
+  Elapsed = Seconds() - Start;
+  printf("Decoding a fixed width move: %.1f ns\n", Elapsed * 1e9 / Messages);
+  const string& Frame = Move.GetFrame();
+  Start = Seconds();
+  for (unsigned long i = 0; i < Messages; i++)
+  {
+    unsigned long Position = 0;
+    unsigned long Value;
+    while (GameServerMessage::ReadVarint(Frame, Position, Value))
+      Sink += Value;
+  }
+  Elapsed = Seconds() - Start;
+  printf("Decoding a compact move: %.1f ns\n", Elapsed * 1e9 / Messages);
+
+  /* Broadcast to a room, encoded once and referenced by each queue, against
+     encoded again for each observer */
+  const unsigned int Observers[] = {10, 100, 1000};
+  for (unsigned int i = 0; i < sizeof(Observers) / sizeof(Observers[0]); i++)
+  {
+    vector<list<GameServerMessage> > Queues(Observers[i]);
+    const unsigned long Broadcasts = 5000000 / Observers[i];
+    Start = Seconds();
+    for (unsigned long j = 0; j < Broadcasts; j++)
+    {
+      GameServerMessage Message = MoveMessage(j, 12 | 28 << 8);
+      for (unsigned int k = 0; k < Observers[i]; k++)
+      {
+        Queues[k].push_back(Message);
+        Queues[k].pop_front();
+      }
+    }
+    double Shared = (Seconds() - Start) * 1e9 / Broadcasts;
+    for (unsigned int k = 0; k < Observers[i]; k++)
+      Queues[k].push_back(Move);
+    Start = Seconds();
+    for (unsigned long j = 0; j < Broadcasts; j++)
+      for (unsigned int k = 0; k < Observers[i]; k++)
+      {
+        Queues[k].push_back(MoveMessage(j, 12 | 28 << 8));
+        Queues[k].pop_front();
+      }
+    double Copied = (Seconds() - Start) * 1e9 / Broadcasts;
+    printf("Broadcast to %4u observers: %.2f us encoded once, %.2f us encoded for each\n", Observers[i], Shared / 1000, Copied / 1000);
+  }
+
+  /* The lobby's room list at 10000 rooms, rebuilt against the copy kept
+     until a room changes */
+  const unsigned int Rooms = 10000;
+  const unsigned int Lists = 200;
+  GameServerMessage List;
+  Start = Seconds();
+  for (unsigned int i = 0; i < Lists; i++)
+  {
+    List = GameServerMessage();
+    for (unsigned int j = 0; j < Rooms; j++)
+      List.Append(RoomMessage(j));
+  }
+  double Rebuilt = (Seconds() - Start) * 1e6 / Lists;
+  const unsigned long Copies = 5000000;
+  Start = Seconds();
+  for (unsigned long i = 0; i < Copies; i++)
+  {
+    GameServerMessage Copy = List;
+    Sink += Copy.GetData().size();
+  }
+  double Copied = (Seconds() - Start) * 1e9 / Copies;
+  printf("Room list of %u rooms, %u bytes: %.0f us rebuilt, %.0f ns from the kept copy\n", Rooms, (unsigned int)List.GetData().size(), Rebuilt, Copied);
+  return 0;
+}
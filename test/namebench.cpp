@@ -0,0 +1,82 @@
+/*
+* NameBench.cpp - Benchmark of the searches of names by prefix.
+*
+* Copyright (C) 2007-2011 Marc-André Lamothe.
+*
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU Library General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, write to the Free Software
+* Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+*/
+#include "../src/gameserver.h"
+#include "bench.h"
+#include <ctype.h>
+#include <set>
+
+static const char* Syllables[] = {"al", "be", "chi", "do", "er", "fa", "gu", "ho", "is", "ka", "lo", "mi", "no", "pa", "ri", "su", "ta", "vo"};
+
+int main()
+{
+  /* 100000 players with made up names */
+  const unsigned int Players = 100000;
+  GameServerSnapshot Snapshot;
+  set<pair<string, unsigned int> > Index;
+  Snapshot.Clients.resize(Players);
+  for (unsigned int i = 0; i < Players; i++)
+  {
+    string Name;
+    for (unsigned int j = 0; j < 4; j++)
+      Name += Syllables[Random() % (sizeof(Syllables) / sizeof(Syllables[0]))];
+    Name[0] = toupper((unsigned char)Name[0]);
+    Snapshot.Clients[i].Id = i + 1;
+    Snapshot.Clients[i].Name = Name;
+
+    /* Folded like the lobby's index */
+    for (unsigned int j = 0; j < Name.size(); j++)
+      Name[j] = tolower((unsigned char)Name[j]);
+    Index.insert(make_pair(Name, i + 1));
+  }
+
+  /* Prefixes of one, two and three syllables, and the most results a query returns */
+  const unsigned long Limit = 100;
+  const char* Prefixes[] = {"ka", "kalo", "kalomi"};
+  for (unsigned int i = 0; i < sizeof(Prefixes) / sizeof(Prefixes[0]); i++)
+  {
+    string Prefix(Prefixes[i]);
+    vector<pair<unsigned int, string> > Results;
+
+    /* The lobby's sorted index, from the first name not before the prefix */
+    const unsigned long Lookups = 200000;
+    double Start = Seconds();
+    for (unsigned long j = 0; j < Lookups; j++)
+    {
+      Results.clear();
+      set<pair<string, unsigned int> >::const_iterator it = Index.lower_bound(make_pair(Prefix, 0U));
+      for (; it != Index.end() && Results.size() < Limit && it->first.compare(0, Prefix.size(), Prefix) == 0; it++)
+        Results.push_back(make_pair(it->second, it->first));
+    }
+    double Indexed = (Seconds() - Start) * 1e6 / Lookups;
+    unsigned int Found = Results.size();
+
+    /* The admin page's search of the snapshot */
+    const unsigned long Searches = 20;
+    Start = Seconds();
+    for (unsigned long j = 0; j < Searches; j++)
+    {
+      Results.clear();
+      GameServer::SearchSnapshot(&Snapshot, PlayerNameQuery, Prefix, Limit, Results);
+    }
+    double Scanned = (Seconds() - Start) * 1e6 / Searches;
+    printf("Prefix \"%s\" among %u players, %u results: %.1f us indexed, %.0f us searching the snapshot\n", Prefixes[i], Players, Found, Indexed, Scanned);
+  }
+  return 0;
+}
@@ -0,0 +1,98 @@
+/*
+* PerftBench.cpp - Benchmark of the move generator and of the validation of
+* the moves played.
+*
+* Copyright (C) 2007-2011 Marc-André Lamothe.
+*
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU Library General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, write to the Free Software
+* Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+*/
+#include "../src/chessboard.h"
+#include "bench.h"
+
+static const struct
+{
+  const char* Name;
+  const char* Fen;
+  unsigned int Depth;
+} Positions[] =
+{
+  {"Initial position", "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1", 5},
+  {"Kiwipete", "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1", 4}
+};
+
+int main()
+{
+  ChessBoard::Initialise();
+  ChessBoard Board;
+
+  /* Move generation */
+  for (unsigned int i = 0; i < sizeof(Positions) / sizeof(Positions[0]); i++)
+  {
+    Board.SetPosition(Positions[i].Fen);
+    double Start = Seconds();
+    unsigned long long Nodes = Board.Perft(Positions[i].Depth);
+    double Elapsed = Seconds() - Start;
+    printf("Perft %u of %s: %llu nodes, %.1f million nodes per second\n", Positions[i].Depth, Positions[i].Name, Nodes, Nodes / Elapsed / 1e6);
+  }
+
+  /* Random games, replayed the way the server checks each move played in a
+     room: the move is made and the board is asked whether the game is over */
+  vector<ChessBoard::Move> Games;
+  vector<unsigned int> Lengths;
+  ChessBoard::Move Moves[ChessBoard::MaxMoves];
+  for (unsigned int i = 0; i < 200; i++)
+  {
+    Board.Reset();
+    unsigned int Length = 0;
+    while (Length < 200 && !Board.IsGameOver())
+    {
+      unsigned int Count = Board.GenerateMoves(Moves);
+      ChessBoard::Move Played = Moves[Random() % Count];
+      Board.MakeMove(Played.From, Played.To, (ChessBoard::PieceType)Played.Promotion);
+      Games.push_back(Played);
+      Length++;
+    }
+    Lengths.push_back(Length);
+  }
+
+  unsigned long Validated = 0;
+  double Start = Seconds();
+  while (Validated < 500000)
+  {
+    unsigned int Position = 0;
+    for (unsigned int i = 0; i < Lengths.size(); i++)
+    {
+      Board.Reset();
+      for (unsigned int j = 0; j < Lengths[i]; j++, Position++)
+      {
+        Board.MakeMove(Games[Position].From, Games[Position].To, (ChessBoard::PieceType)Games[Position].Promotion);
+        Sink += Board.IsGameOver();
+      }
+      Validated += Lengths[i];
+    }
+  }
+  double Elapsed = Seconds() - Start;
+  printf("Validation of %lu moves from %u random games: %.0f ns per move\n", Validated, (unsigned int)Lengths.size(), Elapsed * 1e9 / Validated);
+
+  /* A rook blocked by its own pawn */
+  const unsigned long Refusals = 1000000;
+  Board.Reset();
+  Start = Seconds();
+  for (unsigned long i = 0; i < Refusals; i++)
+    Sink += Board.MakeMove(0, 56);
+  Elapsed = Seconds() - Start;
+  printf("Refusal of an illegal move: %.0f ns\n", Elapsed * 1e9 / Refusals);
+  return 0;
+}
@@ -0,0 +1,76 @@
+/*
+* PerftTest.cpp - Checks of the move generator against known perft results.
+*
+* Copyright (C) 2007-2011 Marc-André Lamothe.
+*
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU Library General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, write to the Free Software
+* Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+*/
+#include "../src/chessboard.h"
+#include "check.h"
+
+/* Leaf counts from the usual test positions, the deepest ones take a few
+   seconds at most */
+static const struct
+{
+  const char* Fen;
+  unsigned int Depth;
+  unsigned long long Nodes;
+} Positions[] =
+{
+  {"rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1", 1, 20ULL},
+  {"rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1", 2, 400ULL},
+  {"rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1", 3, 8902ULL},
+  {"rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1", 4, 197281ULL},
+  {"rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1", 5, 4865609ULL},
+  /* Kiwipete, castling, en passant and promotions */
+  {"r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1", 1, 48ULL},
+  {"r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1", 2, 2039ULL},
+  {"r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1", 3, 97862ULL},
+  {"r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1", 4, 4085603ULL},
+  /* Discovered checks and pinned en passant captures */
+  {"8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 0 1", 5, 674624ULL},
+  /* Promotions with check, castling through attacked squares */
+  {"r3k2r/Pppp1ppp/1b3nbN/nP6/BBP1P3/q4N2/Pp1P2PP/R2Q1RK1 w kq - 0 1", 4, 422333ULL},
+  {"rnbq1k1r/pp1Pbppp/2p5/8/2B5/8/PPP1NnPP/RNBQK2R w KQ - 1 8", 4, 2103487ULL},
+  {"r4rk1/1pp1qppp/p1np1n2/2b1p1B1/2B1P1b1/P1NP1N2/1PP1QPPP/R4RK1 w - - 0 10", 4, 3894594ULL}
+};
+
+int main()
+{
+  ChessBoard::Initialise();
+  ChessBoard Board;
+  char Description[256];
+  for (unsigned int i = 0; i < sizeof(Positions) / sizeof(Positions[0]); i++)
+  {
+    bool Set = Board.SetPosition(Positions[i].Fen);
+    snprintf(Description, sizeof(Description), "%s can be set up", Positions[i].Fen);
+    Check(Set, Description);
+    if (!Set)
+      continue;
+    unsigned long long Nodes = Board.Perft(Positions[i].Depth);
+    snprintf(Description, sizeof(Description), "%s at depth %u gives %lu, not %lu", Positions[i].Fen, Positions[i].Depth, (unsigned long)Positions[i].Nodes, (unsigned long)Nodes);
+    Check(Nodes == Positions[i].Nodes, Description);
+  }
+
+  /* Malformed records leave the starting position */
+  const char* Malformed[] = {"", "8/8/8/8/8/8/8/8 w - - 0 1", "rnbqkbnr/pppppppp/9/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1", "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR x KQkq - 0 1", "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP w KQkq - 0 1"};
+  for (unsigned int i = 0; i < sizeof(Malformed) / sizeof(Malformed[0]); i++)
+  {
+    snprintf(Description, sizeof(Description), "\"%s\" is refused", Malformed[i]);
+    Check(!Board.SetPosition(Malformed[i]) && Board.Perft(1) == 20, Description);
+  }
+
+  return Report("perft");
+}
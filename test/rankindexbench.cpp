@@ -0,0 +1,79 @@
+/*
+* RankIndexBench.cpp - Benchmark of the room indexes answering paged queries.
+*
+* Copyright (C) 2007-2011 Marc-André Lamothe.
+*
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU Library General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, write to the Free Software
+* Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+*/
+#include "../src/gameserverrankindex.h"
+#include "bench.h"
+#include <set>
+
+int main()
+{
+  /* 100000 rooms, a filter matching one in four, and pages of the most
+     rooms a query returns */
+  const unsigned int Rooms = 100000;
+  const unsigned int Limit = 100;
+  GameServerRankIndex Index;
+  set<unsigned int> Sorted;
+  for (unsigned int i = 1; i <= Rooms; i++)
+    if (Random() % 4 == 0)
+    {
+      Index.Insert(i);
+      Sorted.insert(i);
+    }
+  unsigned long Total = Index.Size();
+
+  /* A page at a random offset, found by rank */
+  const unsigned long Queries = 200000;
+  double Start = Seconds();
+  for (unsigned long i = 0; i < Queries; i++)
+  {
+    unsigned long Offset = Random() % Total;
+    for (unsigned long j = Offset; j < Total && j < Offset + Limit; j++)
+      Sink += Index.Find(j);
+  }
+  double Ranked = (Seconds() - Start) * 1e9 / Queries;
+
+  /* The same pages found by walking the sorted rooms to the offset */
+  const unsigned long Walks = 2000;
+  Start = Seconds();
+  for (unsigned long i = 0; i < Walks; i++)
+  {
+    unsigned long Offset = Random() % Total;
+    set<unsigned int>::const_iterator it = Sorted.begin();
+    for (unsigned long j = 0; j < Offset; j++)
+      it++;
+    for (unsigned long j = 0; it != Sorted.end() && j < Limit; it++, j++)
+      Sink += *it;
+  }
+  double Walked = (Seconds() - Start) * 1e9 / Walks;
+  printf("Page of %u of %lu rooms matching among %u: %.1f us by rank, %.1f us walking to the offset\n", Limit, Total, Rooms, Ranked / 1000, Walked / 1000);
+
+  /* Rooms leaving and entering the filter as they change */
+  vector<unsigned int> Slots(Sorted.begin(), Sorted.end());
+  const unsigned long Changes = 5000000;
+  Start = Seconds();
+  for (unsigned long i = 0; i < Changes; i++)
+  {
+    unsigned int Slot = Slots[Random() % Slots.size()];
+    Index.Erase(Slot);
+    Index.Insert(Slot);
+  }
+  double Changed = (Seconds() - Start) * 1e9 / Changes;
+  printf("Room erased and inserted again: %.0f ns\n", Changed);
+  return 0;
+}
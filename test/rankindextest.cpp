@@ -0,0 +1,70 @@
+/*
+* RankIndexTest.cpp - Checks of the index that finds the rooms by rank.
+*
+* Copyright (C) 2007-2011 Marc-André Lamothe.
+*
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU Library General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, write to the Free Software
+* Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+*/
+#include "../src/gameserverrankindex.h"
+#include "check.h"
+#include <set>
+
+int main()
+{
+  GameServerRankIndex Index;
+  Check(Index.Size() == 0 && Index.Find(0) == 0, "an empty index finds nothing");
+
+  /* The elements are ranked by slot, whatever the order they are inserted in */
+  Index.Insert(5);
+  Index.Insert(1);
+  Index.Insert(3);
+  Check(Index.Size() == 3, "every slot inserted is counted");
+  Check(Index.Find(0) == 1 && Index.Find(1) == 3 && Index.Find(2) == 5, "the elements are ranked by slot");
+  Check(Index.Find(3) == 0, "a rank past the end finds nothing");
+
+  /* Growing the tree keeps the elements already in it */
+  Index.Insert(1000);
+  Check(Index.Find(2) == 5 && Index.Find(3) == 1000, "the tree grows with the slots");
+  Index.Erase(3);
+  Check(Index.Size() == 3 && Index.Find(1) == 5 && Index.Find(2) == 1000, "erasing an element shifts the ranks after it");
+
+  /* Compare with a set through many changes */
+  GameServerRankIndex Large;
+  set<unsigned int> Expected;
+  unsigned int Seed = 12345;
+  for (unsigned int i = 0; i < 20000; i++)
+  {
+    Seed = Seed * 1103515245 + 12345;
+    unsigned int Slot = (Seed >> 8) % 5000 + 1;
+    if (Expected.insert(Slot).second)
+      Large.Insert(Slot);
+    else
+    {
+      Expected.erase(Slot);
+      Large.Erase(Slot);
+    }
+  }
+  bool Same = (Large.Size() == Expected.size());
+  unsigned long Rank = 0;
+  set<unsigned int>::iterator it;
+  for (it = Expected.begin(); it != Expected.end() && Same; it++)
+    Same = (Large.Find(Rank++) == *it);
+  Check(Same, "the ranks match an ordered set after random changes");
+
+  Large.Clear();
+  Check(Large.Size() == 0 && Large.Find(0) == 0, "a cleared index is empty");
+
+  return Report("rank index");
+}
@@ -0,0 +1,116 @@
+/*
+* SlotMapBench.cpp - Benchmark of the slot maps holding the clients and rooms.
+*
+* Copyright (C) 2007-2011 Marc-André Lamothe.
+*
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU Library General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, write to the Free Software
+* Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+*/
+#include "../src/gameserverslotmap.h"
+#include "bench.h"
+#include <new>
+#include <stdlib.h>
+
+/* Every allocation is counted, to tell the memory taken by each entry */
+static unsigned long Allocated = 0;
+
+void* operator new(size_t Size) throw(std::bad_alloc)
+{
+  Allocated += Size;
+  void* Result = malloc(Size);
+  if (Result == NULL)
+    throw std::bad_alloc();
+  return Result;
+}
+
+void operator delete(void* Pointer) throw()
+{
+  free(Pointer);
+}
+
+struct Entry
+{
+  unsigned int Id;
+};
+
+int main()
+{
+  /* The lookups by id replaced a walk through the list, timed as well up to
+     the size where it takes too long */
+  const unsigned int Sizes[] = {100, 10000, 100000};
+  for (unsigned int i = 0; i < sizeof(Sizes) / sizeof(Sizes[0]); i++)
+  {
+    unsigned int Size = Sizes[i];
+    unsigned long Before = Allocated;
+    GameServerSlotMap<Entry*> Map;
+    vector<Entry> Entries(Size);
+    vector<unsigned int> Handles(Size);
+    for (unsigned int j = 0; j < Size; j++)
+    {
+      Handles[j] = Map.Insert(&Entries[j]);
+      Entries[j].Id = Handles[j];
+    }
+    unsigned long Memory = Allocated - Before - Size * (sizeof(Entry) + sizeof(unsigned int));
+
+    /* Random lookups */
+    const unsigned int Lookups = 10000000;
+    vector<unsigned int> Order(65536);
+    for (unsigned int j = 0; j < Order.size(); j++)
+      Order[j] = Handles[Random() % Size];
+    double Start = Seconds();
+    for (unsigned int j = 0; j < Lookups; j++)
+      Sink += (*Map.Find(Order[j & 65535]))->Id;
+    double Lookup = (Seconds() - Start) * 1e9 / Lookups;
+
+    double Walk = 0;
+    if (Size <= 10000)
+    {
+      const unsigned int Walks = 20000000 / Size;
+      Start = Seconds();
+      for (unsigned int j = 0; j < Walks; j++)
+      {
+        unsigned int Id = Order[j & 65535];
+        unsigned int k;
+        for (k = 0; k < Size && Entries[k].Id != Id; k++);
+        Sink += k;
+      }
+      Walk = (Seconds() - Start) * 1e9 / Walks;
+    }
+
+    /* Iterating like the admin snapshot and the lobby list do */
+    const unsigned int Passes = 100000000 / Size;
+    Start = Seconds();
+    for (unsigned int j = 0; j < Passes; j++)
+      for (unsigned int k = 0; k < Map.Size(); k++)
+        Sink += Map[k]->Id;
+    double Iteration = (Seconds() - Start) * 1e9 / ((double)Passes * Size);
+
+    /* Removing and inserting again, as clients come and go */
+    const unsigned int Changes = 5000000;
+    Start = Seconds();
+    for (unsigned int j = 0; j < Changes; j++)
+    {
+      unsigned int Position = Random() % Size;
+      Map.Remove(Handles[Position]);
+      Handles[Position] = Map.Insert(&Entries[Position]);
+    }
+    double Change = (Seconds() - Start) * 1e9 / Changes;
+
+    printf("%6u entries: lookup %.1f ns", Size, Lookup);
+    if (Walk > 0)
+      printf(" (list walk %.0f ns)", Walk);
+    printf(", iteration %.2f ns per entry, removal and insertion %.1f ns, %lu bytes per entry\n", Iteration, Change, Memory / Size);
+  }
+  return 0;
+}
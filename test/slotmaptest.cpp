@@ -0,0 +1,70 @@
+/*
+* SlotMapTest.cpp - Checks of the generational slot map.
+*
+* Copyright (C) 2007-2011 Marc-André Lamothe.
+*
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU Library General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, write to the Free Software
+* Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+*/
+#include "../src/gameserverslotmap.h"
+#include "check.h"
+
+int main()
+{
+  GameServerSlotMap<int> Map;
+  Check(Map.Find(0) == NULL, "0 is never a handle");
+  Check(Map.Find(0x100001) == NULL, "an empty map finds nothing");
+
+  unsigned int A = Map.Insert(1);
+  unsigned int B = Map.Insert(2);
+  Check(A != 0 && B != 0 && A != B, "handles are distinct and never 0");
+  Check(Map.Find(A) != NULL && *Map.Find(A) == 1, "a value is found by its handle");
+
+  /* A freed slot answers to neither its old handle nor the next one */
+  Check(Map.Remove(A), "a value is removed by its handle");
+  Check(Map.Find(A) == NULL, "a removed handle is stale");
+  Check(Map.Find(0x200000 | (A & GameServerSlotMap<int>::MaxSize)) == NULL, "a free slot doesn't answer to its next handle");
+  Check(!Map.Remove(A), "a value is only removed once");
+  Check(Map.Size() == 1 && Map[0] == 2, "the last value fills the hole");
+  Check(*Map.Find(B) == 2, "a moved value is still found");
+
+  /* A reused slot gets a new generation */
+  unsigned int C = Map.Insert(3);
+  Check((C & GameServerSlotMap<int>::MaxSize) == (A & GameServerSlotMap<int>::MaxSize), "free slots are reused");
+  Check(C != A && Map.Find(A) == NULL, "a reused slot has a new handle");
+  Check(*Map.Find(C) == 3, "a reused slot finds its new value");
+
+  /* Removing the last value leaves the map empty */
+  Map.Remove(B);
+  Map.Remove(C);
+  Check(Map.Size() == 0 && Map.Find(B) == NULL && Map.Find(C) == NULL, "an emptied map finds nothing");
+
+  /* The generation wraps without giving out 0 or a tagged handle */
+  GameServerSlotMap<int> Wrapped;
+  unsigned int Handle = Wrapped.Insert(0);
+  for (unsigned int i = 0; i < 4096; i++)
+  {
+    Wrapped.Remove(Handle);
+    Handle = Wrapped.Insert(i);
+    Check(Handle != 0 && (Handle & GameServerSlotMap<int>::TagBit) == 0, "generations stay within 11 bits");
+  }
+
+  /* Tagged and untagged handles never collide */
+  GameServerSlotMap<int> Tagged(true);
+  unsigned int T = Tagged.Insert(4);
+  Check((T & GameServerSlotMap<int>::TagBit) != 0, "tagged handles have the top bit set");
+  Check(Map.Find(T) == NULL && Tagged.Find(T & ~GameServerSlotMap<int>::TagBit) == NULL, "tagged and untagged handles never collide");
+
+  return Report("slot map");
+}
@@ -0,0 +1,123 @@
+/*
+* TimingWheelTest.cpp - Checks of the timing wheel that runs the deadlines.
+*
+* Copyright (C) 2007-2011 Marc-André Lamothe.
+*
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU Library General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, write to the Free Software
+* Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+*/
+#include "../src/timingwheel.h"
+#include "check.h"
+#include <map>
+
+/* How many times each timer expired */
+static map<TimingWheelTimer*, unsigned int> Expiries;
+
+/* Advances the wheel up to the tick, checking that every timer expires in
+   the step that reaches its expiry, and counts them */
+static unsigned int Advance(TimingWheel& Wheel, unsigned long Tick, bool& Exact)
+{
+  unsigned long Previous = Wheel.GetTick();
+  vector<TimingWheelTimer*> Expired;
+  Wheel.Advance(Tick, Expired);
+  for (unsigned int i = 0; i < Expired.size(); i++)
+  {
+    if ((long)(Expired[i]->Expiry - Previous) <= 0 || (long)(Expired[i]->Expiry - Tick) > 0 || Expired[i]->Slot != NULL)
+      Exact = false;
+    Expiries[Expired[i]]++;
+  }
+  return Expired.size();
+}
+
+static void CheckExpiries(unsigned long Start, const char* Description)
+{
+  /* One timer on each side of every level's boundaries, and beyond the wheel's span */
+  static const unsigned long Delays[] = {1, 2, 63, 64, 65, 4095, 4096, 4097, 262143, 262144, 262145, 16777215, 16777216, 16777300};
+  const unsigned int Count = sizeof(Delays) / sizeof(Delays[0]);
+  TimingWheel Wheel(Start);
+  TimingWheelTimer Timers[Count];
+  Expiries.clear();
+  for (unsigned int i = 0; i < Count; i++)
+  {
+    TimingWheel::Initialise(&Timers[i]);
+    Wheel.Schedule(&Timers[i], Start + Delays[i]);
+  }
+  bool Exact = true;
+  unsigned int Expired = 0;
+  for (unsigned long Tick = Start + 1; (long)(Start + 16777301 - Tick) > 0; Tick += 7)
+    Expired += Advance(Wheel, Tick, Exact);
+  Expired += Advance(Wheel, Start + 16777301, Exact);
+  bool Once = true;
+  for (unsigned int i = 0; i < Count; i++)
+    Once = Once && (Expiries[&Timers[i]] == 1);
+  Check(Exact && Expired == Count && Once, Description);
+}
+
+int main()
+{
+  CheckExpiries(0, "timers expire on their tick at every level");
+  CheckExpiries((unsigned long)-100000, "timers expire on their tick when the ticks wrap around");
+
+  /* Cancelled timers never expire, rescheduled ones expire once */
+  TimingWheel Wheel(1000);
+  TimingWheelTimer A, B, C;
+  TimingWheel::Initialise(&A);
+  TimingWheel::Initialise(&B);
+  TimingWheel::Initialise(&C);
+  Expiries.clear();
+  Wheel.Schedule(&A, 1100);
+  Wheel.Schedule(&B, 1100);
+  Wheel.Schedule(&C, 5000);
+  Wheel.Cancel(&A);
+  Wheel.Cancel(&A);
+  Check(A.Slot == NULL, "a cancelled timer isn't scheduled");
+  Wheel.Schedule(&C, 1200);
+  bool Exact = true;
+  Check(Advance(Wheel, 1150, Exact) == 1 && Expiries[&B] == 1 && Expiries[&A] == 0, "a cancelled timer doesn't expire");
+  Check(Advance(Wheel, 6000, Exact) == 1 && Expiries[&C] == 1 && C.Expiry == 1200, "a rescheduled timer expires once, on its new tick");
+
+  /* A timer already due expires on the next tick */
+  Wheel.Schedule(&A, 10);
+  Check(Advance(Wheel, 6001, Exact) == 1 && Expiries[&A] == 1, "a timer already due expires on the next tick");
+  Check(Exact, "timers expire in the step reaching their tick");
+
+  /* Many timers scheduled and cancelled at random */
+  const unsigned int Count = 5000;
+  static TimingWheelTimer Timers[Count];
+  TimingWheel Large(0);
+  unsigned int Seed = 12345;
+  unsigned int Scheduled = 0;
+  for (unsigned int i = 0; i < Count; i++)
+  {
+    TimingWheel::Initialise(&Timers[i]);
+    Seed = Seed * 1103515245 + 12345;
+    Large.Schedule(&Timers[i], (Seed >> 8) % 1000000 + 1);
+    Scheduled++;
+    if (Seed % 4 == 0)
+    {
+      Large.Cancel(&Timers[i]);
+      Scheduled--;
+    }
+  }
+  unsigned int Expired = 0;
+  for (unsigned long Tick = 0; Tick <= 1000000; Tick += (Seed >> 16) % 500 + 1)
+  {
+    Seed = Seed * 1103515245 + 12345;
+    Expired += Advance(Large, Tick, Exact);
+  }
+  Expired += Advance(Large, 1000001, Exact);
+  Check(Exact && Expired == Scheduled, "every timer left scheduled expires once, on its tick");
+
+  return Report("timing wheel");
+}